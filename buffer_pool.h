@@ -0,0 +1,220 @@
+/*
+ * File:		buffer_pool.h
+ * Summary:		A pool of device buffers that hands out and takes back cl_mem objects, so a
+ *				process that runs job after job doesn't call clCreateBuffer/clReleaseMemObject
+ *				for every one of them.
+ *
+ *				Requests are rounded up to a size class (four classes per power of two, so at
+ *				most 25% of a buffer goes unused) and idle buffers are kept in one bucket per
+ *				size class and access flags (read-only, write-only, read-write), since a buffer
+ *				made for one kind of access can't stand in for another. Buffers built on host
+ *				memory (CL_MEM_USE_HOST_PTR) are tied to that memory, so they are created and
+ *				released as usual and never kept.
+ *
+ *				A buffer that comes back out of the pool holds whatever the last job left in it.
+ */
+
+#ifndef BUFFER_POOL_H
+#define BUFFER_POOL_H
+
+#include <stdio.h>
+#include <map>
+#include <utility>
+#include <vector>
+
+#include "cl.h"
+
+
+namespace ocl
+{
+
+class BufferPool;
+
+
+// a buffer on loan from a BufferPool -- it goes back to the pool when this goes away or is Reset( ):
+
+class PooledBuffer
+{
+public:
+	PooledBuffer( ) : Pool( NULL ), Mem( NULL ) { }
+	PooledBuffer( BufferPool *pool, cl_mem mem ) : Pool( pool ), Mem( mem ) { }
+	~PooledBuffer( ) { Reset( ); }
+
+	PooledBuffer( PooledBuffer &&other ) : Pool( other.Pool ), Mem( other.Mem ) { other.Mem = NULL; }
+	PooledBuffer & operator=( PooledBuffer &&other )
+	{
+		if( this != &other )
+		{
+			Reset( );
+			Pool = other.Pool;
+			Mem = other.Mem;
+			other.Mem = NULL;
+		}
+		return *this;
+	}
+
+	PooledBuffer( const PooledBuffer & ) = delete;
+	PooledBuffer & operator=( const PooledBuffer & ) = delete;
+
+	operator cl_mem( ) const { return Mem; }
+	cl_mem	Get( ) const { return Mem; }
+	bool	Ok( ) const { return Mem != NULL; }
+	inline void Reset( );
+
+private:
+	BufferPool *	Pool;
+	cl_mem			Mem;
+};
+
+
+class BufferPool
+{
+public:
+	struct Stats
+	{
+		size_t	Requests;		// calls to Acquire( )
+		size_t	Hits;			// ... that were handed an idle buffer instead of a new one
+		size_t	LiveBytes;		// bytes currently allocated from the driver (on loan or idle)
+		size_t	IdleBytes;		// ... of which are sitting in the pool
+		size_t	PeakBytes;		// the most LiveBytes has ever been
+	};
+
+	// maxIdleBytes caps how much idle memory the pool holds on to (0 = no cap):
+	BufferPool( ) : Context( NULL ), MaxIdleBytes( 0 ) { Clear( ); }
+	explicit BufferPool( cl_context context, size_t maxIdleBytes = 0 ) : Context( context ), MaxIdleBytes( maxIdleBytes ) { Clear( ); }
+	~BufferPool( ) { Trim( ); }
+
+	BufferPool( const BufferPool & ) = delete;
+	BufferPool & operator=( const BufferPool & ) = delete;
+
+	// use the pool for buffers in this context (releases anything idle from the old one):
+	void Init( cl_context context, size_t maxIdleBytes = 0 )
+	{
+		Trim( );
+		Context = context;
+		MaxIdleBytes = maxIdleBytes;
+	}
+
+	// borrow a buffer of at least bytes bytes -- name is only used in error messages:
+	PooledBuffer Acquire( cl_mem_flags flags, size_t bytes, void *hostPtr = NULL, const char *name = "a buffer" )
+	{
+		Counts.Requests++;
+
+		if( hostPtr != NULL || ( flags & ( CL_MEM_USE_HOST_PTR | CL_MEM_COPY_HOST_PTR ) ) != 0 )
+			return PooledBuffer( this, Create( flags, bytes, hostPtr, name ) );
+
+		Key key( flags & AccessFlags, SizeClass( bytes ) );
+		std::vector<cl_mem> &idle = Idle[key];
+		if( ! idle.empty( ) )
+		{
+			cl_mem mem = idle.back( );
+			idle.pop_back( );
+			Counts.Hits++;
+			Counts.IdleBytes -= key.second;
+			return PooledBuffer( this, mem );
+		}
+
+		return PooledBuffer( this, Create( key.first, key.second, NULL, name ) );
+	}
+
+	// take a buffer back -- it is kept for the next Acquire( ) unless it can't be reused
+	// or the pool is already holding as much idle memory as it is allowed to:
+	void Recycle( cl_mem mem )
+	{
+		if( mem == NULL )
+			return;
+
+		cl_mem_flags flags = 0;
+		size_t bytes = 0;
+		clGetMemObjectInfo( mem, CL_MEM_FLAGS, sizeof(flags), &flags, NULL );
+		clGetMemObjectInfo( mem, CL_MEM_SIZE,  sizeof(bytes), &bytes, NULL );
+
+		bool keep = ( flags & ( CL_MEM_USE_HOST_PTR | CL_MEM_COPY_HOST_PTR ) ) == 0
+				 && ( MaxIdleBytes == 0 || Counts.IdleBytes + bytes <= MaxIdleBytes );
+		if( keep )
+		{
+			Idle[ Key( flags & AccessFlags, bytes ) ].push_back( mem );
+			Counts.IdleBytes += bytes;
+		}
+		else
+		{
+			clReleaseMemObject( mem );
+			Counts.LiveBytes -= bytes;
+		}
+	}
+
+	// release every idle buffer back to the driver:
+	void Trim( )
+	{
+		for( std::map<Key, std::vector<cl_mem> >::iterator it = Idle.begin( ); it != Idle.end( ); ++it )
+		{
+			for( size_t i = 0; i < it->second.size( ); i++ )
+				clReleaseMemObject( it->second[i] );
+			Counts.LiveBytes -= it->first.second * it->second.size( );
+		}
+		Idle.clear( );
+		Counts.IdleBytes = 0;
+	}
+
+	const Stats &	GetStats( ) const { return Counts; }
+
+	void PrintStats( FILE *fp ) const
+	{
+		fprintf( fp, "Buffer Pool: %d requests , %d reused (%.1lf%%) , %.2lf MB allocated now (%.2lf MB idle) , %.2lf MB at peak\n",
+			(int)Counts.Requests, (int)Counts.Hits, Counts.Requests > 0 ? 100. * (double)Counts.Hits / (double)Counts.Requests : 0.,
+			(double)Counts.LiveBytes / 1048576., (double)Counts.IdleBytes / 1048576., (double)Counts.PeakBytes / 1048576. );
+	}
+
+	// round bytes up to the size class that holds it: 4, 5, 6 or 7 times a power of two:
+	static size_t SizeClass( size_t bytes )
+	{
+		size_t step = 1;
+		while( step * 8 <= bytes )
+			step *= 2;
+		return ( ( bytes + step - 1 ) / step ) * step;		// bytes <= 8*step, so this is 4..8 steps
+	}
+
+private:
+	typedef std::pair<cl_mem_flags, size_t>	Key;		// access flags, size class
+
+	static const cl_mem_flags AccessFlags = CL_MEM_READ_WRITE | CL_MEM_READ_ONLY | CL_MEM_WRITE_ONLY;
+
+	cl_context						Context;
+	size_t							MaxIdleBytes;
+	std::map<Key, std::vector<cl_mem> >	Idle;
+	Stats							Counts;
+
+	void Clear( )
+	{
+		Counts.Requests = Counts.Hits = 0;
+		Counts.LiveBytes = Counts.IdleBytes = Counts.PeakBytes = 0;
+	}
+
+	cl_mem Create( cl_mem_flags flags, size_t bytes, void *hostPtr, const char *name )
+	{
+		cl_int status;
+		cl_mem mem = clCreateBuffer( Context, flags, bytes, hostPtr, &status );
+		if( status != CL_SUCCESS )
+		{
+			fprintf( stderr, "clCreateBuffer failed for %s (%d)\n", name, status );
+			return NULL;
+		}
+
+		Counts.LiveBytes += bytes;
+		if( Counts.LiveBytes > Counts.PeakBytes )
+			Counts.PeakBytes = Counts.LiveBytes;
+		return mem;
+	}
+};
+
+
+inline void PooledBuffer::Reset( )
+{
+	if( Mem != NULL && Pool != NULL )
+		Pool->Recycle( Mem );
+	Mem = NULL;
+}
+
+}		// namespace ocl
+
+#endif
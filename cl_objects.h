@@ -0,0 +1,161 @@
+/*
+ * File:		cl_objects.h
+ * Summary:		Move-only owners for the OpenCL objects that molecular_dynamics.cpp creates
+ *				(contexts, command queues, programs, kernels and buffers), so each one is
+ *				released exactly once -- when its owner goes away or is Reset( ) -- and a
+ *				long-running process can create and tear down as many as it likes without
+ *				leaking driver resources.
+ *
+ *				Each one can be handed straight to the cl... calls, since it converts to the
+ *				plain OpenCL handle it owns. The constructors that create an object report a
+ *				failure on stderr the same way the rest of the program does, and keep the
+ *				returned status in Status( ).
+ */
+
+#ifndef CL_OBJECTS_H
+#define CL_OBJECTS_H
+
+#include <stdio.h>
+
+#include "cl.h"
+
+
+namespace ocl
+{
+
+// the part that is the same for every kind of object: own one handle and call Release on it:
+
+template <typename T, cl_int (CL_API_CALL *Release)( T )>
+class Handle
+{
+public:
+	Handle( ) : Object( NULL ), CreateStatus( CL_SUCCESS ) { }
+	explicit Handle( T object ) : Object( object ), CreateStatus( CL_SUCCESS ) { }
+	~Handle( ) { Reset( ); }
+
+	Handle( Handle &&other ) : Object( other.Object ), CreateStatus( other.CreateStatus ) { other.Object = NULL; }
+	Handle & operator=( Handle &&other )
+	{
+		if( this != &other )
+		{
+			Reset( other.Object );
+			CreateStatus = other.CreateStatus;
+			other.Object = NULL;
+		}
+		return *this;
+	}
+
+	Handle( const Handle & ) = delete;				// one owner only
+	Handle & operator=( const Handle & ) = delete;
+
+	operator T( ) const { return Object; }
+	T		Get( ) const { return Object; }
+	cl_int	Status( ) const { return CreateStatus; }
+	bool	Ok( ) const { return Object != NULL && CreateStatus == CL_SUCCESS; }
+
+	// release what we hold (if anything) and take over object instead:
+	void Reset( T object = NULL )
+	{
+		if( Object != NULL )
+			Release( Object );
+		Object = object;
+	}
+
+protected:
+	T		Object;
+	cl_int	CreateStatus;
+
+	// take over a newly created object and complain if creating it failed:
+	void Created( T object, cl_int status, const char *what, const char *name = NULL )
+	{
+		Reset( object );
+		CreateStatus = status;
+		if( status != CL_SUCCESS && name != NULL )
+			fprintf( stderr, "%s failed for %s (%d)\n", what, name, status );
+		else if( status != CL_SUCCESS )
+			fprintf( stderr, "%s failed (%d)\n", what, status );
+	}
+};
+
+
+class Context : public Handle<cl_context, clReleaseContext>
+{
+public:
+	Context( ) { }
+	explicit Context( cl_device_id device )
+	{
+		cl_int status;
+		cl_context context = clCreateContext( NULL, 1, &device, NULL, NULL, &status );
+		Created( context, status, "clCreateContext" );
+	}
+};
+
+
+class Queue : public Handle<cl_command_queue, clReleaseCommandQueue>
+{
+public:
+	Queue( ) { }
+	Queue( cl_context context, cl_device_id device, cl_command_queue_properties properties = 0 )
+	{
+		cl_int status;
+		cl_command_queue queue = clCreateCommandQueue( context, device, properties, &status );
+		Created( queue, status, "clCreateCommandQueue" );
+	}
+};
+
+
+class Program : public Handle<cl_program, clReleaseProgram>
+{
+public:
+	Program( ) { }
+	explicit Program( cl_program program ) : Handle( program ) { }		// already created (and built) elsewhere
+};
+
+
+class Kernel : public Handle<cl_kernel, clReleaseKernel>
+{
+public:
+	Kernel( ) { }
+	Kernel( cl_program program, const char *name )
+	{
+		cl_int status;
+		cl_kernel kernel = clCreateKernel( program, name, &status );
+		Created( kernel, status, "clCreateKernel", name );
+	}
+};
+
+
+// a device buffer of count T's:
+
+template <typename T>
+class Buffer : public Handle<cl_mem, clReleaseMemObject>
+{
+public:
+	Buffer( ) : Count( 0 ) { }
+	Buffer( cl_context context, cl_mem_flags flags, size_t count, T *hostPtr = NULL, const char *name = "a buffer" ) : Count( count )
+	{
+		cl_int status;
+		cl_mem mem = clCreateBuffer( context, flags, count * sizeof(T), hostPtr, &status );
+		Created( mem, status, "clCreateBuffer", name );
+	}
+
+	Buffer( Buffer &&other ) : Handle( static_cast<Handle &&>( other ) ), Count( other.Count ) { other.Count = 0; }
+	Buffer & operator=( Buffer &&other )
+	{
+		Handle::operator=( static_cast<Handle &&>( other ) );
+		Count = other.Count;
+		if( this != &other )
+			other.Count = 0;
+		return *this;
+	}
+
+	size_t	Size( ) const { return Count; }
+	size_t	Bytes( ) const { return Count * sizeof(T); }
+
+private:
+	size_t	Count;
+};
+
+}		// namespace ocl
+
+#endif
@@ -0,0 +1,135 @@
+/*
+ * File:		cpu_backend.h
+ * Summary:		The same MatrixMult and MatrixAdd jobs as the OpenCL kernels, run on the host's
+ *				own cores with OpenMP -- both to check the OpenCL results against and to see
+ *				whether the OpenCL path is actually beating the CPU it is running next to.
+ *
+ *				Gemm( ) works through c in cache-sized blocks: a KC x NC panel of b is packed
+ *				into a contiguous buffer (so the inner loop streams through it with unit stride),
+ *				then the threads split the rows of c between them and add each row's share of
+ *				a times the panel into it, with the loop along the row vectorized by omp simd.
+ *				One row of c (NC floats) stays in the L1 cache for a whole panel, and the panel
+ *				(KC x NC floats) stays in the L2 cache for every row.
+ *
+ *				All the matrices are row-major with their rows ld... floats apart, like the
+ *				kernels' arguments.
+ */
+
+#ifndef CPU_BACKEND_H
+#define CPU_BACKEND_H
+
+#include <stdlib.h>
+#include <omp.h>
+#include <vector>
+
+
+namespace cpu
+{
+
+// the block sizes (in floats) -- a packed panel of b is KC x NC and the threads take MC rows of c at a time:
+
+#ifndef CPU_MC
+#define CPU_MC		32
+#endif
+
+#ifndef CPU_KC
+#define CPU_KC		256
+#endif
+
+#ifndef CPU_NC
+#define CPU_NC		512
+#endif
+
+
+// c = alpha * a * b + beta * c, where c is m x n, a is m x k and b is k x n
+// (c is not read when beta is 0, just like in the kernels):
+
+inline void Gemm( int m, int n, int k, float alpha, const float *a, int lda, const float *b, int ldb, float beta, float *c, int ldc )
+{
+	std::vector<float> panel( (size_t)CPU_KC * CPU_NC );
+	float *bp = &panel[0];
+
+	for( int jc = 0; jc < n; jc += CPU_NC )
+	{
+		int nc = ( n - jc < CPU_NC ) ? n - jc : CPU_NC;
+
+		// apply beta to this column block of c first, so each panel below only has to add on to it:
+
+		#pragma omp parallel for schedule(static)
+		for( int i = 0; i < m; i++ )
+		{
+			float *ci = c + (size_t)i * ldc + jc;
+			if( beta == 0.f )
+			{
+				#pragma omp simd
+				for( int j = 0; j < nc; j++ )
+					ci[j] = 0.f;
+			}
+			else if( beta != 1.f )
+			{
+				#pragma omp simd
+				for( int j = 0; j < nc; j++ )
+					ci[j] *= beta;
+			}
+		}
+
+		for( int pc = 0; pc < k; pc += CPU_KC )
+		{
+			int kc = ( k - pc < CPU_KC ) ? k - pc : CPU_KC;
+
+			// pack b[pc:pc+kc][jc:jc+nc] into the panel, nc floats to a row:
+
+			#pragma omp parallel for schedule(static)
+			for( int p = 0; p < kc; p++ )
+			{
+				const float *brow = b + (size_t)( pc + p ) * ldb + jc;
+				float *prow = bp + (size_t)p * nc;
+				#pragma omp simd
+				for( int j = 0; j < nc; j++ )
+					prow[j] = brow[j];
+			}
+
+			// c[i][jc:jc+nc] += alpha * a[i][pc:pc+kc] * panel, MC rows of c to a thread at a time:
+
+			#pragma omp parallel for schedule(dynamic)
+			for( int ic = 0; ic < m; ic += CPU_MC )
+			{
+				int mc = ( m - ic < CPU_MC ) ? m - ic : CPU_MC;
+				for( int i = ic; i < ic + mc; i++ )
+				{
+					const float *ai = a + (size_t)i * lda + pc;
+					float *ci = c + (size_t)i * ldc + jc;
+					for( int p = 0; p < kc; p++ )
+					{
+						float aip = alpha * ai[p];
+						const float *prow = bp + (size_t)p * nc;
+						#pragma omp simd
+						for( int j = 0; j < nc; j++ )
+							ci[j] += aip * prow[j];
+					}
+				}
+			}
+		}
+	}
+}
+
+
+// c = a + b, where all three are m x n:
+
+inline void Add( int m, int n, const float *a, int lda, const float *b, int ldb, float *c, int ldc )
+{
+	#pragma omp parallel for schedule(static)
+	for( int i = 0; i < m; i++ )
+	{
+		const float *ai = a + (size_t)i * lda;
+		const float *bi = b + (size_t)i * ldb;
+		float *ci = c + (size_t)i * ldc;
+		#pragma omp simd
+		for( int j = 0; j < n; j++ )
+			ci[j] = ai[j] + bi[j];
+	}
+}
+
+}		// namespace cpu
+
+#endif
@@ -0,0 +1,64 @@
+#!/usr/bin/env python3
+#
+# Program:	embed_kernels.py
+# Summary:	Turns the OpenCL kernel files into kernel_sources.h, a table of string constants
+#			that is compiled into molecular_dynamics, so the program doesn't have to find and
+#			read the .cl files at run time.
+#			Run this again (from this directory) whenever a .cl file changes:
+#
+#				python3 embed_kernels.py [file.cl ...]
+#
+
+import os
+import sys
+
+KERNEL_FILES = [ "matrix_mult.cl", "matrix_add.cl", "probe.cl" ]
+OUTPUT_FILE = "kernel_sources.h"
+
+
+def quote( line, newline ):
+	# one C string literal per source line, so no single literal gets too long for any compiler
+	text = line.replace( '\\', '\\\\' ).replace( '"', '\\"' ).replace( '\t', '\\t' )
+	return '"' + text + ( '\\n' if newline else '' ) + '"'
+
+
+def main( ):
+	files = sys.argv[1:] or KERNEL_FILES
+	here = os.path.dirname( os.path.abspath( __file__ ) )
+
+	out = [ ]
+	out.append( "// kernel_sources.h -- generated by embed_kernels.py from " + ", ".join( files ) + ": do not edit\n" )
+	out.append( "\n" )
+	out.append( "#ifndef KERNEL_SOURCES_H\n" )
+	out.append( "#define KERNEL_SOURCES_H\n" )
+	out.append( "\n" )
+	out.append( "struct KernelSource\n" )
+	out.append( "{\n" )
+	out.append( "\tconst char *\tFileName;\n" )
+	out.append( "\tconst char *\tText;\n" )
+	out.append( "};\n" )
+	out.append( "\n" )
+	out.append( "constexpr KernelSource KernelSources[ ] =\n" )
+	out.append( "{\n" )
+	for name in files:
+		with open( os.path.join( here, name ), "r" ) as fp:
+			lines = fp.read( ).split( "\n" )
+		out.append( "\t{ \"" + name + "\",\n" )
+		for i, line in enumerate( lines ):
+			last = ( i == len( lines ) - 1 )
+			if last and line == "":
+				break
+			out.append( "\t\t" + quote( line, not last ) + "\n" )
+		out.append( "\t},\n" )
+	out.append( "};\n" )
+	out.append( "\n" )
+	out.append( "constexpr int NumKernelSources = sizeof(KernelSources) / sizeof(KernelSources[0]);\n" )
+	out.append( "\n" )
+	out.append( "#endif\n" )
+
+	with open( os.path.join( here, OUTPUT_FILE ), "w" ) as fp:
+		fp.write( "".join( out ) )
+
+
+if __name__ == "__main__":
+	main( )
@@ -0,0 +1,346 @@
+// kernel_sources.h -- generated by embed_kernels.py from matrix_mult.cl, matrix_add.cl, probe.cl: do not edit
+
+#ifndef KERNEL_SOURCES_H
+#define KERNEL_SOURCES_H
+
+struct KernelSource
+{
+	const char *	FileName;
+	const char *	Text;
+};
+
+constexpr KernelSource KernelSources[ ] =
+{
+	{ "matrix_mult.cl",
+		"#define IN\n"
+		"#define OUT\n"
+		"#define INOUT\n"
+		"\n"
+		"// all of the MatrixMult... kernels compute dC = alpha * dA * dB + beta * dC (dC is not read when beta is 0)\n"
+		"// and ignore work-items outside the m x n result, so the global work size can be rounded up to a multiple\n"
+		"// of the local work size\n"
+		"\n"
+		"#define ALPHABETA(cij,cindex)\t( beta == 0.f ? alpha * (cij) : alpha * (cij) + beta * dC[cindex] )\n"
+		"\n"
+		"// the length of the dot products -- the host can build a copy of the kernels for the k it is going to\n"
+		"// run them with, and pass it in with -DKSIZE=..., so the loops over k have a constant trip count the\n"
+		"// compiler can unroll (the k argument is then expected to match):\n"
+		"\n"
+		"#ifdef KSIZE\n"
+		"#define KLEN\tKSIZE\n"
+		"#else\n"
+		"#define KLEN\tk\n"
+		"#endif\n"
+		"\n"
+		"kernel void MatrixMult( int m, int n, int k, float alpha, IN global const float *dA, int lda, IN global const float *dB, int ldb, float beta, INOUT global float *dC, int ldc )\n"
+		"{\n"
+		"\t// [dA] is m x k, each row lda floats apart\n"
+		"\t// [dB] is k x n, each row ldb floats apart\n"
+		"\t// [dC] is m x n, each row ldc floats apart\n"
+		"\t// but all the matrixs' rows are really linear in memory\n"
+		"\n"
+		"\tint crow = get_global_id( 0 );\n"
+		"\tint ccol = get_global_id( 1 );\n"
+		"\tif( crow >= m || ccol >= n )\n"
+		"\t\treturn;\n"
+		"\n"
+		"\tint aindex = crow * lda;\t\t// a[i][0]\n"
+		"\tint bindex = ccol;\t\t\t\t// b[0][j]\n"
+		"\tint cindex = crow * ldc + ccol;\t// c[i][j]\n"
+		"\n"
+		"\tfloat cij = 0.;\n"
+		"\tfor( int kk = 0; kk < KLEN; kk++ )\n"
+		"\t{\n"
+		"\t\tcij += dA[aindex] * dB[bindex];\n"
+		"\t\taindex++;\n"
+		"\t\tbindex += ldb;\n"
+		"\t}\n"
+		"\tdC[cindex] = ALPHABETA( cij, cindex );\n"
+		"}\n"
+		"\n"
+		"\n"
+		"// the tile width used by MatrixMultTiled -- the host passes this in with -DTILESIZE=...\n"
+		"// note: the work-group must be TILESIZE x TILESIZE:\n"
+		"\n"
+		"#ifndef TILESIZE\n"
+		"#define TILESIZE\t8\n"
+		"#endif\n"
+		"\n"
+		"kernel void MatrixMultTiled( int m, int n, int k, float alpha, IN global const float *dA, int lda, IN global const float *dB, int ldb, float beta, INOUT global float *dC, int ldc )\n"
+		"{\n"
+		"\t// same product as MatrixMult, but each work-group first copies a TILESIZE x TILESIZE\n"
+		"\t// block of dA and of dB into local memory and then every work-item in the group\n"
+		"\t// reuses those blocks, so each global element is loaded once per work-group\n"
+		"\t// instead of once per work-item\n"
+		"\t// work-items outside the matrices still have to reach the barriers, so they load\n"
+		"\t// zeros into the tiles instead of returning early\n"
+		"\n"
+		"\tlocal float tA[TILESIZE][TILESIZE];\n"
+		"\tlocal float tB[TILESIZE][TILESIZE];\n"
+		"\n"
+		"\tint crow = get_global_id( 0 );\n"
+		"\tint ccol = get_global_id( 1 );\n"
+		"\tint trow = get_local_id( 0 );\n"
+		"\tint tcol = get_local_id( 1 );\n"
+		"\n"
+		"\tfloat cij = 0.;\n"
+		"\tfor( int t = 0; t < KLEN; t += TILESIZE )\n"
+		"\t{\n"
+		"\t\ttA[trow][tcol] = ( crow < m && t + tcol < KLEN ) ? dA[crow * lda + t + tcol] : 0.f;\t// a[i][t+tcol]\n"
+		"\t\ttB[trow][tcol] = ( t + trow < KLEN && ccol < n ) ? dB[(t + trow) * ldb + ccol] : 0.f;\t// b[t+trow][j]\n"
+		"\t\tbarrier( CLK_LOCAL_MEM_FENCE );\n"
+		"\n"
+		"\t\tfor( int kk = 0; kk < TILESIZE; kk++ )\n"
+		"\t\t{\n"
+		"\t\t\tcij += tA[trow][kk] * tB[kk][tcol];\n"
+		"\t\t}\n"
+		"\t\tbarrier( CLK_LOCAL_MEM_FENCE );\n"
+		"\t}\n"
+		"\n"
+		"\tif( crow < m && ccol < n )\n"
+		"\t{\n"
+		"\t\tint cindex = crow * ldc + ccol;\t// c[i][j]\n"
+		"\t\tdC[cindex] = ALPHABETA( cij, cindex );\n"
+		"\t}\n"
+		"}\n"
+		"\n"
+		"\n"
+		"// the size of the block of dC that each MatrixMultBlocked work-item computes -- the host passes\n"
+		"// these in with -DMICROROWS=... -DMICROCOLS=... and shrinks the global work size to match:\n"
+		"\n"
+		"#ifndef MICROROWS\n"
+		"#define MICROROWS\t4\n"
+		"#endif\n"
+		"\n"
+		"#ifndef MICROCOLS\n"
+		"#define MICROCOLS\t4\n"
+		"#endif\n"
+		"\n"
+		"kernel void MatrixMultBlocked( int m, int n, int k, float alpha, IN global const float *dA, int lda, IN global const float *dB, int ldb, float beta, INOUT global float *dC, int ldc )\n"
+		"{\n"
+		"\t// same product as MatrixMult, but each work-item computes a MICROROWS x MICROCOLS\n"
+		"\t// block of dC held in registers, so every dA value it loads is used MICROCOLS times,\n"
+		"\t// every dB value is used MICROROWS times, and the sums are independent of each other\n"
+		"\n"
+		"\t// micro-tiles that hang over the edge of dC load from the last row of dA and the\n"
+		"\t// last column of dB instead of testing every load, and only store what is inside\n"
+		"\n"
+		"\tint crow = get_global_id( 0 ) * MICROROWS;\n"
+		"\tint ccol = get_global_id( 1 ) * MICROCOLS;\n"
+		"\tif( crow >= m || ccol >= n )\n"
+		"\t\treturn;\n"
+		"\n"
+		"\tint arow[MICROROWS];\n"
+		"\tfor( int r = 0; r < MICROROWS; r++ )\n"
+		"\t\tarow[r] = min( crow + r, m - 1 ) * lda;\n"
+		"\n"
+		"\tint bcol[MICROCOLS];\n"
+		"\tfor( int c = 0; c < MICROCOLS; c++ )\n"
+		"\t\tbcol[c] = min( ccol + c, n - 1 );\n"
+		"\n"
+		"\tfloat cij[MICROROWS][MICROCOLS];\n"
+		"\tfor( int r = 0; r < MICROROWS; r++ )\n"
+		"\t{\n"
+		"\t\tfor( int c = 0; c < MICROCOLS; c++ )\n"
+		"\t\t\tcij[r][c] = 0.;\n"
+		"\t}\n"
+		"\n"
+		"\tint bindex = 0;\t\t\t\t\t// b[0][0]\n"
+		"\tfor( int kk = 0; kk < KLEN; kk++ )\n"
+		"\t{\n"
+		"\t\tfloat aik[MICROROWS];\n"
+		"\t\tfor( int r = 0; r < MICROROWS; r++ )\n"
+		"\t\t\taik[r] = dA[arow[r] + kk];\n"
+		"\n"
+		"\t\tfor( int c = 0; c < MICROCOLS; c++ )\n"
+		"\t\t{\n"
+		"\t\t\tfloat bkj = dB[bindex + bcol[c]];\n"
+		"\t\t\tfor( int r = 0; r < MICROROWS; r++ )\n"
+		"\t\t\t\tcij[r][c] += aik[r] * bkj;\n"
+		"\t\t}\n"
+		"\t\tbindex += ldb;\n"
+		"\t}\n"
+		"\n"
+		"\tfor( int r = 0; r < MICROROWS && crow + r < m; r++ )\n"
+		"\t{\n"
+		"\t\tint cindex = ( crow + r ) * ldc + ccol;\t// c[i+r][j]\n"
+		"\t\tfor( int c = 0; c < MICROCOLS && ccol + c < n; c++, cindex++ )\n"
+		"\t\t\tdC[cindex] = ALPHABETA( cij[r][c], cindex );\n"
+		"\t}\n"
+		"}\n"
+		"\n"
+		"\n"
+		"// the vector width used by the ...Vec kernels -- the host picks 4 or 8 from the device's\n"
+		"// CL_DEVICE_PREFERRED_VECTOR_WIDTH_FLOAT and passes it in with -DVECWIDTH=...:\n"
+		"\n"
+		"#ifndef VECWIDTH\n"
+		"#define VECWIDTH\t4\n"
+		"#endif\n"
+		"\n"
+		"#ifndef floatv\n"
+		"#define VCAT(a,b)\ta##b\n"
+		"#define VNAME(a,b)\tVCAT(a,b)\n"
+		"#define floatv\t\tVNAME(float,VECWIDTH)\n"
+		"#define vloadv\t\tVNAME(vload,VECWIDTH)\n"
+		"#define vstorev\t\tVNAME(vstore,VECWIDTH)\n"
+		"#endif\n"
+		"\n"
+		"kernel void MatrixMultVec( int m, int n, int k, float alpha, IN global const float *dA, int lda, IN global const float *dB, int ldb, float beta, INOUT global float *dC, int ldc )\n"
+		"{\n"
+		"\t// same product as MatrixMult, but each work-item computes VECWIDTH consecutive elements\n"
+		"\t// of a row of dC: every dA value is multiplied by a vector load of a row piece of dB\n"
+		"\t// the global size in dimension 1 is rounded up, so the last work-items of a row\n"
+		"\t// finish the tail one element at a time (or do nothing)\n"
+		"\n"
+		"\tint crow = get_global_id( 0 );\n"
+		"\tint ccol = get_global_id( 1 ) * VECWIDTH;\n"
+		"\tif( crow >= m || ccol >= n )\n"
+		"\t\treturn;\n"
+		"\n"
+		"\tint aindex = crow * lda;\t\t// a[i][0]\n"
+		"\tint bindex = ccol;\t\t\t\t// b[0][j]\n"
+		"\tint cindex = crow * ldc + ccol;\t// c[i][j]\n"
+		"\n"
+		"\tif( ccol + VECWIDTH <= n )\n"
+		"\t{\n"
+		"\t\tfloatv cij = (floatv)( 0.f );\n"
+		"\t\tfor( int kk = 0; kk < KLEN; kk++ )\n"
+		"\t\t{\n"
+		"\t\t\tcij += dA[aindex] * vloadv( 0, dB + bindex );\n"
+		"\t\t\taindex++;\n"
+		"\t\t\tbindex += ldb;\n"
+		"\t\t}\n"
+		"\t\tif( beta == 0.f )\n"
+		"\t\t\tvstorev( alpha * cij, 0, dC + cindex );\n"
+		"\t\telse\n"
+		"\t\t\tvstorev( alpha * cij + beta * vloadv( 0, dC + cindex ), 0, dC + cindex );\n"
+		"\t}\n"
+		"\telse\n"
+		"\t{\n"
+		"\t\tfor( int j = ccol; j < n; j++ )\n"
+		"\t\t{\n"
+		"\t\t\tfloat cij = 0.;\n"
+		"\t\t\tfor( int kk = 0; kk < KLEN; kk++ )\n"
+		"\t\t\t\tcij += dA[aindex + kk] * dB[kk * ldb + j];\n"
+		"\t\t\tdC[cindex] = ALPHABETA( cij, cindex );\n"
+		"\t\t\tcindex++;\n"
+		"\t\t}\n"
+		"\t}\n"
+		"}"
+	},
+	{ "matrix_add.cl",
+		"#define IN\n"
+		"#define OUT\n"
+		"\n"
+		"kernel void MatrixAdd( int m, int n, IN global const float *dA, int lda, IN global const float *dB, int ldb, OUT global float *dC, int ldc )\n"
+		"{\n"
+		"\t// [dA] is m x n, each row lda floats apart\n"
+		"\t// [dB] is m x n, each row ldb floats apart\n"
+		"\t// [dC] is m x n, each row ldc floats apart\n"
+		"\t// but all the matrixs' rows are really linear in memory\n"
+		"\t// work-items outside the m x n result do nothing, so the global work size can be rounded up\n"
+		"\n"
+		"\tint crow = get_global_id( 0 );\n"
+		"\tint ccol = get_global_id( 1 );\n"
+		"\tif( crow >= m || ccol >= n )\n"
+		"\t\treturn;\n"
+		"\n"
+		"\tint aindex = crow * lda + ccol;\t// a[i][j]\n"
+		"\tint bindex = crow * ldb + ccol;\t// b[i][j]\n"
+		"\tint cindex = crow * ldc + ccol;\t// c[i][j]\n"
+		"\n"
+		"\tdC[cindex] = dA[aindex] + dB[bindex];\n"
+		"}\n"
+		"\n"
+		"\n"
+		"// the vector width used by the ...Vec kernels -- the host picks 4 or 8 from the device's\n"
+		"// CL_DEVICE_PREFERRED_VECTOR_WIDTH_FLOAT and passes it in with -DVECWIDTH=...:\n"
+		"\n"
+		"#ifndef VECWIDTH\n"
+		"#define VECWIDTH\t4\n"
+		"#endif\n"
+		"\n"
+		"#ifndef floatv\n"
+		"#define VCAT(a,b)\ta##b\n"
+		"#define VNAME(a,b)\tVCAT(a,b)\n"
+		"#define floatv\t\tVNAME(float,VECWIDTH)\n"
+		"#define vloadv\t\tVNAME(vload,VECWIDTH)\n"
+		"#define vstorev\t\tVNAME(vstore,VECWIDTH)\n"
+		"#endif\n"
+		"\n"
+		"kernel void MatrixAddVec( int m, int n, IN global const float *dA, int lda, IN global const float *dB, int ldb, OUT global float *dC, int ldc )\n"
+		"{\n"
+		"\t// same sum as MatrixAdd, but each work-item adds VECWIDTH consecutive elements of a row\n"
+		"\t// with one vector load from each of dA and dB and one vector store to dC\n"
+		"\t// the global size in dimension 1 is rounded up, so the last work-items of a row\n"
+		"\t// finish the tail one element at a time (or do nothing)\n"
+		"\n"
+		"\tint crow = get_global_id( 0 );\n"
+		"\tint ccol = get_global_id( 1 ) * VECWIDTH;\n"
+		"\tif( crow >= m || ccol >= n )\n"
+		"\t\treturn;\n"
+		"\n"
+		"\tint aindex = crow * lda + ccol;\t// a[i][j]\n"
+		"\tint bindex = crow * ldb + ccol;\t// b[i][j]\n"
+		"\tint cindex = crow * ldc + ccol;\t// c[i][j]\n"
+		"\n"
+		"\tif( ccol + VECWIDTH <= n )\n"
+		"\t{\n"
+		"\t\tvstorev( vloadv( 0, dA + aindex ) + vloadv( 0, dB + bindex ), 0, dC + cindex );\n"
+		"\t}\n"
+		"\telse\n"
+		"\t{\n"
+		"\t\tfor( int j = ccol; j < n; j++ )\n"
+		"\t\t\tdC[cindex++] = dA[aindex++] + dB[bindex++];\n"
+		"\t}\n"
+		"}"
+	},
+	{ "probe.cl",
+		"#define IN\n"
+		"#define OUT\n"
+		"\n"
+		"// short kernels the host times to see how fast a device really is -- how many bytes per second it\n"
+		"// can stream through global memory, and how many floating-point operations per second it can do\n"
+		"\n"
+		"\n"
+		"kernel void ProbeBandwidth( IN global const float4 *src, OUT global float4 *dst )\n"
+		"{\n"
+		"\t// each work-item reads one float4 and writes it back out somewhere else,\n"
+		"\t// so the kernel moves 2 * 16 bytes per work-item\n"
+		"\n"
+		"\tint i = get_global_id( 0 );\n"
+		"\tdst[i] = src[i];\n"
+		"}\n"
+		"\n"
+		"\n"
+		"// how many times ProbeFlops goes around its loop:\n"
+		"\n"
+		"#ifndef PROBEITERS\n"
+		"#define PROBEITERS\t256\n"
+		"#endif\n"
+		"\n"
+		"kernel void ProbeFlops( float seed, OUT global float *dst )\n"
+		"{\n"
+		"\t// each work-item runs 4 independent chains of multiply-adds (so they can overlap in the pipeline),\n"
+		"\t// which is 4 * 2 floating-point operations per time around the loop\n"
+		"\t// the result is stored so the compiler can't throw the loop away\n"
+		"\n"
+		"\tfloat x = seed + (float)get_global_id( 0 );\n"
+		"\tfloat a = x, b = x + 1.f, c = x + 2.f, d = x + 3.f;\n"
+		"\n"
+		"\tfor( int i = 0; i < PROBEITERS; i++ )\n"
+		"\t{\n"
+		"\t\ta = mad( a, 0.999f, 0.001f );\n"
+		"\t\tb = mad( b, 0.999f, 0.001f );\n"
+		"\t\tc = mad( c, 0.999f, 0.001f );\n"
+		"\t\td = mad( d, 0.999f, 0.001f );\n"
+		"\t}\n"
+		"\n"
+		"\tdst[ get_global_id( 0 ) ] = a + b + c + d;\n"
+		"}"
+	},
+};
+
+constexpr int NumKernelSources = sizeof(KernelSources) / sizeof(KernelSources[0]);
+
+#endif
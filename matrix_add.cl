@@ -1,32 +1,65 @@
 #define IN
 #define OUT
 
-kernel void MatrixAdd( IN global const float *dA, IN global const float *dB, IN global int *dMW, OUT global float *dC )
+kernel void MatrixAdd( int m, int n, IN global const float *dA, int lda, IN global const float *dB, int ldb, OUT global float *dC, int ldc )
 {
-	// [dA] is dMW x dMW
-	// [dB] is dMW x dMW
-	// [dC] is dMW x dMW
+	// [dA] is m x n, each row lda floats apart
+	// [dB] is m x n, each row ldb floats apart
+	// [dC] is m x n, each row ldc floats apart
 	// but all the matrixs' rows are really linear in memory
+	// work-items outside the m x n result do nothing, so the global work size can be rounded up
 
-	int mw = *dMW;
 	int crow = get_global_id( 0 );
 	int ccol = get_global_id( 1 );
+	if( crow >= m || ccol >= n )
+		return;
 
-	/*
-	int aindex = crow * mw;			// a[i][0]
-	int bindex = ccol;				// b[0][j]
-	*/
-	int cindex = crow * mw + ccol;	// c[i][j]
+	int aindex = crow * lda + ccol;	// a[i][j]
+	int bindex = crow * ldb + ccol;	// b[i][j]
+	int cindex = crow * ldc + ccol;	// c[i][j]
 
-	/*
-	float cij = 0.;
-	for( int k = 0; k < mw; k++ )
+	dC[cindex] = dA[aindex] + dB[bindex];
+}
+
+
+// the vector width used by the ...Vec kernels -- the host picks 4 or 8 from the device's
+// CL_DEVICE_PREFERRED_VECTOR_WIDTH_FLOAT and passes it in with -DVECWIDTH=...:
+
+#ifndef VECWIDTH
+#define VECWIDTH	4
+#endif
+
+#ifndef floatv
+#define VCAT(a,b)	a##b
+#define VNAME(a,b)	VCAT(a,b)
+#define floatv		VNAME(float,VECWIDTH)
+#define vloadv		VNAME(vload,VECWIDTH)
+#define vstorev		VNAME(vstore,VECWIDTH)
+#endif
+
+kernel void MatrixAddVec( int m, int n, IN global const float *dA, int lda, IN global const float *dB, int ldb, OUT global float *dC, int ldc )
+{
+	// same sum as MatrixAdd, but each work-item adds VECWIDTH consecutive elements of a row
+	// with one vector load from each of dA and dB and one vector store to dC
+	// the global size in dimension 1 is rounded up, so the last work-items of a row
+	// finish the tail one element at a time (or do nothing)
+
+	int crow = get_global_id( 0 );
+	int ccol = get_global_id( 1 ) * VECWIDTH;
+	if( crow >= m || ccol >= n )
+		return;
+
+	int aindex = crow * lda + ccol;	// a[i][j]
+	int bindex = crow * ldb + ccol;	// b[i][j]
+	int cindex = crow * ldc + ccol;	// c[i][j]
+
+	if( ccol + VECWIDTH <= n )
+	{
+		vstorev( vloadv( 0, dA + aindex ) + vloadv( 0, dB + bindex ), 0, dC + cindex );
+	}
+	else
 	{
-		cij += dA[aindex] + dB[bindex];
-		aindex++;
-		bindex += mw;
+		for( int j = ccol; j < n; j++ )
+			dC[cindex++] = dA[aindex++] + dB[bindex++];
 	}
-	dC[cindex] = cij;
-	*/
-	dC[cindex] = dA[cindex] + dB[cindex];
 }
\ No newline at end of file
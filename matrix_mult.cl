@@ -1,27 +1,215 @@
 #define IN
 #define OUT
+#define INOUT
 
-kernel void MatrixMult( IN global const float *dA, IN global const float *dB, IN global int *dMW, OUT global float *dC )
+// all of the MatrixMult... kernels compute dC = alpha * dA * dB + beta * dC (dC is not read when beta is 0)
+// and ignore work-items outside the m x n result, so the global work size can be rounded up to a multiple
+// of the local work size
+
+#define ALPHABETA(cij,cindex)	( beta == 0.f ? alpha * (cij) : alpha * (cij) + beta * dC[cindex] )
+
+// the length of the dot products -- the host can build a copy of the kernels for the k it is going to
+// run them with, and pass it in with -DKSIZE=..., so the loops over k have a constant trip count the
+// compiler can unroll (the k argument is then expected to match):
+
+#ifdef KSIZE
+#define KLEN	KSIZE
+#else
+#define KLEN	k
+#endif
+
+kernel void MatrixMult( int m, int n, int k, float alpha, IN global const float *dA, int lda, IN global const float *dB, int ldb, float beta, INOUT global float *dC, int ldc )
 {
-	// [dA] is dMW x dMW
-	// [dB] is dMW x dMW
-	// [dC] is dMW x dMW
+	// [dA] is m x k, each row lda floats apart
+	// [dB] is k x n, each row ldb floats apart
+	// [dC] is m x n, each row ldc floats apart
 	// but all the matrixs' rows are really linear in memory
 
-	int mw = *dMW;
 	int crow = get_global_id( 0 );
 	int ccol = get_global_id( 1 );
+	if( crow >= m || ccol >= n )
+		return;
 
-	int aindex = crow * mw;			// a[i][0]
+	int aindex = crow * lda;		// a[i][0]
 	int bindex = ccol;				// b[0][j]
-	int cindex = crow * mw + ccol;	// c[i][j]
+	int cindex = crow * ldc + ccol;	// c[i][j]
 
 	float cij = 0.;
-	for( int k = 0; k < mw; k++ )
+	for( int kk = 0; kk < KLEN; kk++ )
 	{
 		cij += dA[aindex] * dB[bindex];
 		aindex++;
-		bindex += mw;
+		bindex += ldb;
+	}
+	dC[cindex] = ALPHABETA( cij, cindex );
+}
+
+
+// the tile width used by MatrixMultTiled -- the host passes this in with -DTILESIZE=...
+// note: the work-group must be TILESIZE x TILESIZE:
+
+#ifndef TILESIZE
+#define TILESIZE	8
+#endif
+
+kernel void MatrixMultTiled( int m, int n, int k, float alpha, IN global const float *dA, int lda, IN global const float *dB, int ldb, float beta, INOUT global float *dC, int ldc )
+{
+	// same product as MatrixMult, but each work-group first copies a TILESIZE x TILESIZE
+	// block of dA and of dB into local memory and then every work-item in the group
+	// reuses those blocks, so each global element is loaded once per work-group
+	// instead of once per work-item
+	// work-items outside the matrices still have to reach the barriers, so they load
+	// zeros into the tiles instead of returning early
+
+	local float tA[TILESIZE][TILESIZE];
+	local float tB[TILESIZE][TILESIZE];
+
+	int crow = get_global_id( 0 );
+	int ccol = get_global_id( 1 );
+	int trow = get_local_id( 0 );
+	int tcol = get_local_id( 1 );
+
+	float cij = 0.;
+	for( int t = 0; t < KLEN; t += TILESIZE )
+	{
+		tA[trow][tcol] = ( crow < m && t + tcol < KLEN ) ? dA[crow * lda + t + tcol] : 0.f;	// a[i][t+tcol]
+		tB[trow][tcol] = ( t + trow < KLEN && ccol < n ) ? dB[(t + trow) * ldb + ccol] : 0.f;	// b[t+trow][j]
+		barrier( CLK_LOCAL_MEM_FENCE );
+
+		for( int kk = 0; kk < TILESIZE; kk++ )
+		{
+			cij += tA[trow][kk] * tB[kk][tcol];
+		}
+		barrier( CLK_LOCAL_MEM_FENCE );
+	}
+
+	if( crow < m && ccol < n )
+	{
+		int cindex = crow * ldc + ccol;	// c[i][j]
+		dC[cindex] = ALPHABETA( cij, cindex );
+	}
+}
+
+
+// the size of the block of dC that each MatrixMultBlocked work-item computes -- the host passes
+// these in with -DMICROROWS=... -DMICROCOLS=... and shrinks the global work size to match:
+
+#ifndef MICROROWS
+#define MICROROWS	4
+#endif
+
+#ifndef MICROCOLS
+#define MICROCOLS	4
+#endif
+
+kernel void MatrixMultBlocked( int m, int n, int k, float alpha, IN global const float *dA, int lda, IN global const float *dB, int ldb, float beta, INOUT global float *dC, int ldc )
+{
+	// same product as MatrixMult, but each work-item computes a MICROROWS x MICROCOLS
+	// block of dC held in registers, so every dA value it loads is used MICROCOLS times,
+	// every dB value is used MICROROWS times, and the sums are independent of each other
+
+	// micro-tiles that hang over the edge of dC load from the last row of dA and the
+	// last column of dB instead of testing every load, and only store what is inside
+
+	int crow = get_global_id( 0 ) * MICROROWS;
+	int ccol = get_global_id( 1 ) * MICROCOLS;
+	if( crow >= m || ccol >= n )
+		return;
+
+	int arow[MICROROWS];
+	for( int r = 0; r < MICROROWS; r++ )
+		arow[r] = min( crow + r, m - 1 ) * lda;
+
+	int bcol[MICROCOLS];
+	for( int c = 0; c < MICROCOLS; c++ )
+		bcol[c] = min( ccol + c, n - 1 );
+
+	float cij[MICROROWS][MICROCOLS];
+	for( int r = 0; r < MICROROWS; r++ )
+	{
+		for( int c = 0; c < MICROCOLS; c++ )
+			cij[r][c] = 0.;
+	}
+
+	int bindex = 0;					// b[0][0]
+	for( int kk = 0; kk < KLEN; kk++ )
+	{
+		float aik[MICROROWS];
+		for( int r = 0; r < MICROROWS; r++ )
+			aik[r] = dA[arow[r] + kk];
+
+		for( int c = 0; c < MICROCOLS; c++ )
+		{
+			float bkj = dB[bindex + bcol[c]];
+			for( int r = 0; r < MICROROWS; r++ )
+				cij[r][c] += aik[r] * bkj;
+		}
+		bindex += ldb;
+	}
+
+	for( int r = 0; r < MICROROWS && crow + r < m; r++ )
+	{
+		int cindex = ( crow + r ) * ldc + ccol;	// c[i+r][j]
+		for( int c = 0; c < MICROCOLS && ccol + c < n; c++, cindex++ )
+			dC[cindex] = ALPHABETA( cij[r][c], cindex );
+	}
+}
+
+
+// the vector width used by the ...Vec kernels -- the host picks 4 or 8 from the device's
+// CL_DEVICE_PREFERRED_VECTOR_WIDTH_FLOAT and passes it in with -DVECWIDTH=...:
+
+#ifndef VECWIDTH
+#define VECWIDTH	4
+#endif
+
+#ifndef floatv
+#define VCAT(a,b)	a##b
+#define VNAME(a,b)	VCAT(a,b)
+#define floatv		VNAME(float,VECWIDTH)
+#define vloadv		VNAME(vload,VECWIDTH)
+#define vstorev		VNAME(vstore,VECWIDTH)
+#endif
+
+kernel void MatrixMultVec( int m, int n, int k, float alpha, IN global const float *dA, int lda, IN global const float *dB, int ldb, float beta, INOUT global float *dC, int ldc )
+{
+	// same product as MatrixMult, but each work-item computes VECWIDTH consecutive elements
+	// of a row of dC: every dA value is multiplied by a vector load of a row piece of dB
+	// the global size in dimension 1 is rounded up, so the last work-items of a row
+	// finish the tail one element at a time (or do nothing)
+
+	int crow = get_global_id( 0 );
+	int ccol = get_global_id( 1 ) * VECWIDTH;
+	if( crow >= m || ccol >= n )
+		return;
+
+	int aindex = crow * lda;		// a[i][0]
+	int bindex = ccol;				// b[0][j]
+	int cindex = crow * ldc + ccol;	// c[i][j]
+
+	if( ccol + VECWIDTH <= n )
+	{
+		floatv cij = (floatv)( 0.f );
+		for( int kk = 0; kk < KLEN; kk++ )
+		{
+			cij += dA[aindex] * vloadv( 0, dB + bindex );
+			aindex++;
+			bindex += ldb;
+		}
+		if( beta == 0.f )
+			vstorev( alpha * cij, 0, dC + cindex );
+		else
+			vstorev( alpha * cij + beta * vloadv( 0, dC + cindex ), 0, dC + cindex );
+	}
+	else
+	{
+		for( int j = ccol; j < n; j++ )
+		{
+			float cij = 0.;
+			for( int kk = 0; kk < KLEN; kk++ )
+				cij += dA[aindex + kk] * dB[kk * ldb + j];
+			dC[cindex] = ALPHABETA( cij, cindex );
+			cindex++;
+		}
 	}
-	dC[cindex] = cij;
 }
\ No newline at end of file
@@ -14,385 +14,3589 @@
 #include <math.h>
 #include <string.h>
 #include <stdlib.h>
+#include <float.h>
+#include <limits.h>
 #include <omp.h>
+#include <algorithm>
+#include <vector>
+#include <map>
+#include <string>
+#ifdef WIN32
+#include <process.h>
+#define getpid	_getpid
+#else
+#include <unistd.h>
+#endif
 
 #include "cl.h"
 #include "cl_platform.h"
 
+#include "cl_objects.h"			// ocl::Context, ocl::Queue, ... -- they release what they hold when they go away
+#include "buffer_pool.h"			// ocl::BufferPool -- device buffers that are reused instead of released
+#include "kernel_sources.h"		// the .cl files, compiled in -- re-run embed_kernels.py after changing them
+#include "cpu_backend.h"			// cpu::Gemm( ), cpu::Add( ) -- the same jobs on the host's cores, with OpenMP
+
+
+// the default matrix-width and the number of work-items per work-group:
+// note: the matrices are MATWxMATW unless -m, -n or -k say otherwise and the work group sizes are LocalSize x LocalSize,
+// which is LOCALSIZE unless the tuning database or -local N says otherwise:
+
+#ifndef MATW
+#define MATW		1024
+#endif
+
+#ifndef LOCALSIZE
+#define	LOCALSIZE	8
+#endif
+
+int				LocalSize = LOCALSIZE;
+int				LocalCols = 0;				// the work-groups' second dimension, if they aren't square (only the sweep sets it)
+
+// the tile width used by the MatrixMultTiled kernel (its work groups are TILESIZExTILESIZE):
+// note: this is handed to the kernel compiler as -DTILESIZE=... and can be changed at run time with -tile N:
+
+#ifndef TILESIZE
+#define TILESIZE	LOCALSIZE
+#endif
+
+int				TileSize = TILESIZE;
+
+// the block of the result that each MatrixMultBlocked work-item computes (MICROROWSxMICROCOLS):
+// note: these are handed to the kernel compiler as -DMICROROWS=... -DMICROCOLS=... and can be changed at run time with -micro RxC:
+
+#ifndef MICROROWS
+#define MICROROWS	4
+#endif
+
+#ifndef MICROCOLS
+#define MICROCOLS	4
+#endif
+
+int				MicroRows = MICROROWS;
+int				MicroCols = MICROCOLS;
+
+// kernel specialization: build a copy of the kernels for each k they are run with (-DKSIZE=k), so their loops
+// over k have a constant trip count the compiler can unroll -- each copy is built once, and cached like any other build
+// note: 1 means do -- it can be turned off at run time with -nospecialize:
+
+int				Specialize = 1;
+
+// relaxed floating-point math (-cl-fast-relaxed-math -cl-mad-enable) -- faster, but the results can differ
+// from strict IEEE arithmetic in the last bits
+// note: 0 means don't -- it can be turned on at run time with -fastmath:
+
+int				FastMath = 0;
+
+// the vector width used by the MatrixAddVec and MatrixMultVec kernels (4 or 8):
+// note: 0 means pick it from the device's CL_DEVICE_PREFERRED_VECTOR_WIDTH_FLOAT -- it can be forced at run time with -vec N:
+
+int				VecWidth = 0;
+
+// which code runs the jobs: the OpenCL kernels, the OpenMP code in cpu_backend.h, or both one after the other
+// note: this can be changed at run time with -backend opencl|cpu|both:
+
+enum BackendType
+{
+	BACKEND_OPENCL,
+	BACKEND_CPU,
+	BACKEND_BOTH
+};
+
+int				Backend = BACKEND_OPENCL;
+
+// verification: the input matrices are filled with seeded random numbers, and every result is checked against
+// a reference computed on the host in double precision (VERIFY_ROWS rows by VERIFY_COLS columns of it, spread
+// over the whole matrix, when it is bigger than that)
+// an element fails if it is further from the reference than VERIFY_TOLERANCE * k * FLT_EPSILON times the sum of
+// the magnitudes of the k products that went into it -- the worst a k-term float dot product should be off by --
+// and any failure makes the run exit with a non-zero status
+// note: this can be turned off at run time with -noverify, and the seed changed with -seed N:
+
+#define VERIFY_ROWS			64
+#define VERIFY_COLS			256
+#define VERIFY_TOLERANCE	2.
+
+// the general product is checked too, once for each way of running it, as C = GEMM_ALPHA * A * B + GEMM_BETA * C0
+// with C0 another seeded random matrix (see CheckGemm( )) -- the benchmarked runs all have alpha 1 and beta 0:
+
+#define GEMM_ALPHA			1.5f
+#define GEMM_BETA			-0.5f
+
+int				Verify = 1;
+unsigned int	Seed = 12345;
+int				VerifyFailures = 0;
+
+// the reference results at the sampled rows and columns (see ComputeReference( )):
+
+struct Reference
+{
+	std::vector<int>		Rows;
+	std::vector<int>		Cols;
+	std::vector<double>		Mult;			// a * b
+	std::vector<double>		MultBound;		// ... and the error each element is allowed
+	std::vector<double>		Add;			// a + b
+	std::vector<double>		AddBound;
+	std::vector<double>		Scaled;			// GEMM_ALPHA * a * b + GEMM_BETA * c0
+	std::vector<double>		ScaledBound;
+};
+
+Reference		Ref;
+
+// the size of the product that is run: dC (M x N) = dA (M x K) * dB (K x N)
+// note: these can be changed at run time with -m M, -n N and -k K:
+
+int				M = MATW;
+int				N = MATW;
+int				K = MATW;
+
+// zero-copy mode: the device buffers are created on top of the (page-aligned) host matrices with
+// CL_MEM_USE_HOST_PTR and the results are mapped instead of read, so nothing is copied on devices
+// that share memory with the host
+// note: -1 means use it when the device says CL_DEVICE_HOST_UNIFIED_MEMORY -- it can be forced at run time with -zerocopy or -copy:
+
+int				ZeroCopy = -1;
+
+// the directory where built kernel programs are cached, so later runs with the same sources, build options,
+// device and driver can load the binary instead of compiling again
+// note: this can be changed at run time with -cache DIR, or turned off with -nocache:
+
+const char *	CacheDir = ".";
+
+// pipelined mode: also run the product a panel of PanelRows rows of dC at a time, with the uploads,
+// kernels and downloads of different panels overlapping on separate queues
+// note: 0 means don't -- it can be turned on at run time with -pipeline ROWS:
+
+#define PIPELINE_SLOTS	3		// how many panels can be on the device at once
+
+int				PanelRows = 0;
+
+// out-of-core mode: run the product OocTile x OocTile tiles at a time through a few fixed-size device buffers,
+// so the matrices can be bigger than the device memory
+// note: this is used automatically (with a tile size that fits the device) when the matrices don't fit,
+// and can be forced at run time with -ooc TILE:
+
+int				OocTile = 0;
+
+// the device memory limits, from CL_DEVICE_GLOBAL_MEM_SIZE and CL_DEVICE_MAX_MEM_ALLOC_SIZE:
+
+cl_ulong		DeviceGlobalMem;
+cl_ulong		DeviceMaxAlloc;
+
+// which device to use -- a number (counting every device on every platform from 0) or part of a device name
+// note: NULL means the one that does best in the probe -- it can be set at run time with -device INDEX|NAME:
+
+const char *	DeviceChoice = NULL;
+
+// the sizes of the probe runs that device selection times (see ProbeDevice( )):
+
+#define PROBE_BYTES		(64*1024*1024)		// the most the bandwidth probe copies
+#define PROBE_ITEMS		(256*1024)			// work-items in the flop probe's first run
+#define PROBE_ITERS		256					// ... and how many times each goes around its loop
+#define PROBE_SECONDS	0.02				// the flop probe doubles its work-items until a run takes this long
+
+// what the probe measured for the selected device, in GFLOP/s and GB/s:
+
+double			DeviceGflops = 0.;
+double			DeviceGbps = 0.;
+
+// OpenCL objects:
+// (the ones we create are owned by ocl:: wrappers, which release them when they are Reset( ) or go away)
+cl_platform_id		Platform;
+cl_device_id		Device;
+ocl::Context		Context;
+ocl::Queue			CmdQueue;
+cl_program			Program = NULL;		// the one of Programs that the kernels are being created from
+
+// every build of the kernel sources so far, by the options it was built with -- see UseProgram( ):
+std::map<std::string, ocl::Program>	Programs;
+// the kernels made from them so far, by program and kernel name -- see ProgramKernel( ):
+std::map<std::pair<cl_program, std::string>, ocl::Kernel>	Kernels;
+char *				ProgramSources[2];
+// the device buffers come from here, so repeated jobs reuse them instead of allocating new ones:
+ocl::BufferPool		Pool;
+
+// multi-device mode: every OpenCL device we can find gets a share of the rows of dC, sized by how fast
+// it ran a short probe of the same job, and they all work on their shares at the same time
+// note: 0 means don't -- it can be turned on at run time with -multi:
+
+int				MultiDevice = 0;
+
+// one of the devices in multi-device mode, with its own context, queue and build of the kernels:
+
+enum ShareEvent
+{
+	SHARE_WRITE_A,
+	SHARE_WRITE_B,
+	SHARE_WRITE_C,
+	SHARE_RUN,
+	SHARE_READ_C,
+	NUM_SHARE_EVENTS
+};
+
+struct DeviceWorker
+{
+	cl_device_id		Device;
+	char				Name[256];
+	ocl::Context		Context;
+	ocl::Queue			Queue;
+	ocl::Program		Program;
+	std::map<std::string, ocl::Kernel>	Kernels;	// its kernels, made the first time each one is run
+	ocl::Buffer<float>	dA, dB, dC;					// its share of the matrices (kept from job to job, and only ever grown)
+	cl_event			Events[NUM_SHARE_EVENTS];
+	cl_ulong			MaxAlloc, GlobalMem;		// the device's memory limits, to check that a job fits
+	bool				Fits;						// can it run the current job? (see ShareFits( ))
+	double				Rate;						// rows per second in the last probe
+	int					Row0, Rows;					// its share of the rows
+};
+
+std::vector<DeviceWorker>	Workers;
+
+// the settings a kernel can be run with, which are what the autotuner chooses between:
+
+struct KernelConfig
+{
+	int		LocalSize;		// the work-groups are LocalSize x LocalSize (except MatrixMultTiled's, which are TileSize x TileSize)
+	int		TileSize;		// built in as -DTILESIZE=...
+	int		VecWidth;		// built in as -DVECWIDTH=...
+	int		MicroRows;		// MatrixMultBlocked's block of the result per work-item, built in as -DMICROROWS=...
+	int		MicroCols;		// ... and -DMICROCOLS=...
+};
+
+KernelConfig	DefaultConfig;							// from the command line (or the defaults)
+std::map<std::string, KernelConfig>	Tuned;			// from the tuning database, for this device and these sizes
+
+// autotuning: try each kernel with every local size, tile width and vector width that suits it and the device,
+// and save the fastest in the tuning database (TUNING_FILE in CacheDir) under the device, the matrix sizes and
+// the build flags that change the program (FastMath and Specialize) -- later runs on the same device with the
+// same sizes and flags then use those settings without being told
+// note: 0 means don't -- it can be turned on at run time with -tune
+// (a setting given on the command line with -local, -tile, -micro or -vec is always used as given -- it overrides
+// the database, and the autotuner only tries the other settings):
+
+#define TUNING_FILE		"md_tuning.txt"
+
+int				Autotune = 0;
+bool			UseTuning = true;
+bool			LocalGiven = false, TileGiven = false, MicroGiven = false, VecGiven = false;
+bool			Quiet = false;			// don't report each kernel run (while the autotuner or the benchmark repetitions are running them)
+
+
+// every command we enqueue hands back an event, and the queue is created with profiling turned on,
+// so the device's own timestamps for each command are collected here for the end-of-run report:
+
+enum StageType
+{
+	STAGE_H2D,				// host-to-device transfers
+	STAGE_KERNEL,			// kernel executions
+	STAGE_D2H,				// device-to-host transfers
+	NUM_STAGES
+};
+
+const char *	StageNames[NUM_STAGES] = { "H2D", "Kernel", "D2H" };
+
+struct CommandTiming
+{
+	const char *	Name;
+	StageType		Stage;
+	cl_device_id	Device;		// the device it ran on -- each device's timestamps are by its own clock
+	cl_ulong		Queued;		// nanoseconds, from CL_PROFILING_COMMAND_...
+	cl_ulong		Submit;
+	cl_ulong		Start;
+	cl_ulong		End;
+};
+
+std::vector<CommandTiming>	Timings;
+
+// -trace FILE also writes every profiled command as a Chrome trace,
+// on a track for each queue of each device, along with spans of the host's setup work such as the program
+// builds -- the file can be opened in chrome://tracing or ui.perfetto.dev
+// (unlike Timings, the trace keeps every run: the warmups, every repetition and every sweep point):
+
+struct TraceEvent
+{
+	std::string		Name;
+	const char *	Category;		// a stage name, or "Host"
+	cl_device_id	Device;			// NULL for the host's spans
+	std::string		Queue;			// the track name
+	long long		Start;			// nanoseconds -- by the device's clock, or since TraceStart for the host's spans
+	long long		End;
+	long long		Recorded;		// when the host recorded it (nanoseconds since TraceStart)
+};
+
+const char *	TraceFile = NULL;
+double			TraceStart = 0.;			// omp_get_wtime( ) when main( ) started
+std::vector<TraceEvent>	Trace;
+std::map<cl_command_queue, std::string>	QueueNames;
+
+
+// a command that has been enqueued but may not have finished -- a future for its device time:
+// its Event( ) can go in the wait lists of later commands, so they follow it on the device without the
+// host waiting in between, and the host only waits for it when it asks for Get( ), which records its
+// profiling times (see RecordEvent( )) and returns how long it ran on the device, in seconds
+// (if nobody asks, that happens when it goes away, so every command is recorded and no event leaks):
+
+class Pending
+{
+public:
+	Pending( ) : Handle( NULL ), Stage( STAGE_KERNEL ), Name( "" ), Time( 0. ) { }
+	Pending( cl_event event, StageType stage, const char *name ) : Handle( event ), Stage( stage ), Name( name ), Time( 0. ) { }
+	~Pending( ) { Get( ); }
+
+	Pending( Pending &&other ) : Handle( other.Handle ), Stage( other.Stage ), Name( other.Name ), Time( other.Time ) { other.Handle = NULL; }
+	Pending & operator=( Pending &&other )
+	{
+		if( this != &other )
+		{
+			Get( );
+			Handle = other.Handle;
+			Stage = other.Stage;
+			Name = other.Name;
+			Time = other.Time;
+			other.Handle = NULL;
+		}
+		return *this;
+	}
+
+	Pending( const Pending & ) = delete;
+	Pending & operator=( const Pending & ) = delete;
+
+	cl_event	Event( ) const { return Handle; }			// NULL once it has been recorded (or if the enqueue failed)
+	double		Get( );
+
+private:
+	cl_event		Handle;
+	StageType		Stage;
+	const char *	Name;
+	double			Time;
+};
+
+// the commands nobody needs an answer from -- they are recorded by Settle( ), which the host calls when it
+// has waited for the queue anyway, so they're sure to be finished:
+
+std::vector<Pending>	Unsettled;
+
+
+// how the results are reported -- as text for people (on stderr), or as one CSV row or JSON object
+// per result for scripts (on stdout, with nothing but errors going to stderr):
+
+enum FormatType
+{
+	FORMAT_TEXT,
+	FORMAT_CSV,
+	FORMAT_JSON
+};
+
+int				Format = FORMAT_TEXT;
+std::vector<std::string>	Report;			// the JSON objects, printed as one array at the end
+
+// every run is repeated: WARMUP times untimed (to get the JIT compile, the first touch of the buffers
+// and the clocks ramping up out of the way), then REPS times timed -- the results are reported as
+// the min, median, 95th percentile and standard deviation of the timed runs
+// (these can be changed at run time with -warmup and -reps):
+
+#define WARMUP		1
+#define REPS		5
+
+int				Warmup = WARMUP;
+int				Reps = REPS;
+
+struct BenchStats				// seconds
+{
+	int			Reps;
+	double		Min;
+	double		Median;
+	double		P95;
+	double		Mean;
+	double		StdDev;
+};
+
+// sweep mode (-sweep FILE): instead of the usual runs, run each kernel in SWEEP_KERNELS with each
+// work-group shape in SWEEP_LOCALS (rows x columns) and each kind of math in SWEEP_MATH (strict,
+// or fast for -cl-fast-relaxed-math) on square problems of each size in SWEEP_SIZES, all in one
+// process, and write one CSV row per point to FILE ("-" for stdout)
+// (the lists can be changed at run time with -sweep-sizes, -sweep-local, -sweep-kernels and -sweep-math):
+
+#define SWEEP_SIZES		"256,512,1024,2048"
+#define SWEEP_LOCALS	"4x4,8x8,16x16,16x4,4x16,32x8"
+#define SWEEP_KERNELS	"MatrixMult,MatrixMultTiled,MatrixMultBlocked,MatrixMultVec,MatrixAdd,MatrixAddVec"
+#define SWEEP_MATH		"strict,fast"
+
+const char *	SweepFile = NULL;
+const char *	SweepSizes = SWEEP_SIZES;
+const char *	SweepLocals = SWEEP_LOCALS;
+const char *	SweepKernels = SWEEP_KERNELS;
+const char *	SweepMath = SWEEP_MATH;
+
+
+// the host matrices live on the heap and are sized at run time -- every row starts on a
+// MATRIX_ALIGNMENT boundary so a whole row can be moved with aligned vector loads,
+// and a matrix can also be page aligned, which is what CL_MEM_USE_HOST_PTR wants:
+
+#define MATRIX_ALIGNMENT	64
+#define PAGE_ALIGNMENT		4096
+
+class Matrix
+{
+public:
+	float *		Data;
+	int			Rows;
+	int			Cols;
+	int			Ld;			// floats from the start of one row to the start of the next
+	size_t		Bytes;		// Rows*Ld floats, rounded up to the alignment
+
+	Matrix( ) : Data( NULL ), Rows( 0 ), Cols( 0 ), Ld( 0 ), Bytes( 0 ) { }
+	~Matrix( ) { Free( ); }
+
+	bool		Allocate( int rows, int cols, size_t alignment = MATRIX_ALIGNMENT );
+	void		Free( );
+	float *		operator[ ]( int i ) { return Data + (size_t)i * Ld; }
+
+	Matrix( const Matrix & ) = delete;		// not copyable
+	Matrix &	operator=( const Matrix & ) = delete;
+};
+
+Matrix			hA;
+Matrix			hB;
+Matrix			hC;
+Matrix			hC0;		// what C starts out as in the general products (only allocated when verifying)
+
+const char *	CL_FILE_NAME_1 = { "matrix_mult.cl" };
+const char *	CL_FILE_NAME_2 = { "matrix_add.cl" };
+const char *	CL_FILE_NAME_PROBE = { "probe.cl" };
+
+// the kernel sources normally come from the copies compiled into the program (kernel_sources.h),
+// but while working on the kernels they can be read from the .cl files in a directory instead
+// note: this can be set at run time with -kernels DIR:
+
+const char *	KernelDir = NULL;
+
+// function prototypes:
+void			SelectOpenclDevice();
+double			ProbeDevice( cl_device_id, double *, double * );
+double			ProbeKernel( cl_command_queue, cl_kernel, size_t );
+char *			Vendor( cl_uint );
+char *			Type( cl_device_type );
+Pending			Gemm( const char *, int, int, int, float, cl_mem, int, cl_mem, int, float, cl_mem, int, const std::vector<cl_event> & = std::vector<cl_event>( ) );
+void			SetGemmArgs( cl_kernel, int, int, int, float, cl_mem, int, cl_mem, int, float, cl_mem, int );
+void			GemmWorkSize( const char *, int, int, size_t *, size_t * );
+double			PipelinedGemm( const char *, int, int, int, int, float, Matrix &, Matrix &, float, Matrix & );
+double			OutOfCoreGemm( const char *, int, int, int, int, float, Matrix &, Matrix &, float, Matrix & );
+int				OutOfCoreTile( int, int, int );
+Pending			MatAdd( const char *, int, int, cl_mem, int, cl_mem, int, cl_mem, int, const std::vector<cl_event> & = std::vector<cl_event>( ) );
+void			SetAddArgs( cl_kernel, int, int, cl_mem, int, cl_mem, int, cl_mem, int );
+void			AddWorkSize( const char *, int, int, size_t *, size_t * );
+void			SetupWorkers( const char **, int, const char * );
+cl_kernel		ShareKernel( DeviceWorker &, const char * );
+bool			ShareFits( DeviceWorker &, const char *, int, int, int, Matrix &, Matrix &, Matrix & );
+bool			WorkGroupFits( cl_kernel, cl_device_id, const char *, const size_t * );
+cl_kernel		PrepareShare( DeviceWorker &, const char *, int, int, Matrix &, Matrix &, Matrix & );
+void			EnqueueShare( DeviceWorker &, const char *, int, int, int, int, float, Matrix &, Matrix &, float, Matrix &, bool );
+void			FinishShare( DeviceWorker &, const char * );
+void			SplitRows( const char *, int, int, int, float, Matrix &, Matrix &, float, Matrix & );
+double			MultiDeviceRun( const char *, int, int, int, float, Matrix &, Matrix &, float, Matrix & );
+Pending			RunKernel( cl_kernel, const char *, size_t *, size_t *, const std::vector<cl_event> & );
+void			SetKernelArg( cl_kernel, int, size_t, const void *, const char * );
+void			ReadResults( cl_mem );
+void			ReleaseResults( cl_mem );
+void			KernelOptions( char *, size_t, int );
+void			UseProgram( int );
+void			KeepGiven( KernelConfig & );
+bool			KernelFits( const char *, int );
+cl_kernel		ProgramKernel( const char * );
+void			UseConfig( const char *, int );
+void			Tune( const char *, int, int, int, cl_mem, int, cl_mem, int, cl_mem, int );
+void			LoadTuning( int, int, int );
+void			SaveTuning( int, int, int );
+unsigned long long	DeviceHash( cl_device_id );
+double			RecordEvent( cl_event, StageType, const char * );
+cl_ulong		EventTime( cl_event, cl_profiling_info );
+char *			GetKernelSource( const char * );
+cl_program		BuildProgram( cl_context, cl_device_id, const char **, int, const char * );
+cl_program		LoadProgramBinary( cl_context, cl_device_id, const char *, const char * );
+void			SaveProgramBinary( cl_program, const char * );
+unsigned long long	Hash( unsigned long long, const char * );
+void			PrintTimings( );
+void			Settle( );
+void			NameQueue( cl_command_queue, const char * );
+void			TraceCommand( cl_event, const char *, const char *, cl_ulong, cl_ulong );
+void			TraceHost( const char *, double );
+void			WriteTrace( const char * );
+std::string		JsonSafe( const char * );
+bool			AllocateMatrices( size_t );
+void			RunCpuBackend( );
+bool			RunSweep( const char * );
+void			SplitList( const char *, std::vector<std::string> & );
+double			KernelFlops( const char *, int, int, int );
+double			KernelBytes( const char *, int, int, int );
+void			ReleaseAll( );
+float			RandomValue( unsigned int & );
+void			ComputeReference( );
+void			ClearResults( cl_mem );
+bool			VerifyResults( const char *, bool, bool = false );
+void			LoadC0( cl_mem );
+template <typename Run>
+void			CheckGemm( const char *, cl_mem, Run );
+long long		UlpDistance( float, float );
+void			PrintResults( const char *, const char *, int, int, int, int, const BenchStats &, bool );
+double			RooflinePercent( double, double, bool * );
+void			PrintReport( );
+BenchStats		Summarize( std::vector<double> & );
+template <typename Job>
+BenchStats		Benchmark( Job );
+inline double	Seconds( double time ) { return time; }
+inline double	Seconds( Pending &run ) { return run.Get( ); }
+size_t			RoundUp( size_t, size_t );
+
+
+int main( int argc, char *argv[ ] )
+{
+#ifndef _OPENMP
+        fprintf( stderr, "OpenMP is not enabled!\n" );
+        return 1;
+#endif
+
+	TraceStart = omp_get_wtime( );
+
+	// read the command line options:
+
+	for( int i = 1; i < argc; i++ )
+	{
+		if( strcmp( argv[i], "-m" ) == 0 && i+1 < argc )
+		{
+			M = atoi( argv[++i] );
+		}
+		else if( strcmp( argv[i], "-n" ) == 0 && i+1 < argc )
+		{
+			N = atoi( argv[++i] );
+		}
+		else if( strcmp( argv[i], "-k" ) == 0 && i+1 < argc )
+		{
+			K = atoi( argv[++i] );
+		}
+		else if( strcmp( argv[i], "-local" ) == 0 && i+1 < argc )
+		{
+			LocalSize = atoi( argv[++i] );
+			LocalGiven = true;
+		}
+		else if( strcmp( argv[i], "-tile" ) == 0 && i+1 < argc )
+		{
+			TileSize = atoi( argv[++i] );
+			TileGiven = true;
+		}
+		else if( strcmp( argv[i], "-micro" ) == 0 && i+1 < argc )
+		{
+			if( sscanf( argv[++i], "%dx%d", &MicroRows, &MicroCols ) != 2 )
+				MicroRows = MicroCols = 0;
+			MicroGiven = true;
+		}
+		else if( strcmp( argv[i], "-vec" ) == 0 && i+1 < argc )
+		{
+			VecWidth = atoi( argv[++i] );
+			VecGiven = true;
+		}
+		else if( strcmp( argv[i], "-zerocopy" ) == 0 )
+		{
+			ZeroCopy = 1;
+		}
+		else if( strcmp( argv[i], "-copy" ) == 0 )
+		{
+			ZeroCopy = 0;
+		}
+		else if( strcmp( argv[i], "-cache" ) == 0 && i+1 < argc )
+		{
+			CacheDir = argv[++i];
+		}
+		else if( strcmp( argv[i], "-nocache" ) == 0 )
+		{
+			CacheDir = NULL;
+		}
+		else if( strcmp( argv[i], "-kernels" ) == 0 && i+1 < argc )
+		{
+			KernelDir = argv[++i];
+		}
+		else if( strcmp( argv[i], "-pipeline" ) == 0 && i+1 < argc )
+		{
+			PanelRows = atoi( argv[++i] );
+		}
+		else if( strcmp( argv[i], "-ooc" ) == 0 && i+1 < argc )
+		{
+			OocTile = atoi( argv[++i] );
+		}
+		else if( strcmp( argv[i], "-multi" ) == 0 )
+		{
+			MultiDevice = 1;
+		}
+		else if( strcmp( argv[i], "-device" ) == 0 && i+1 < argc )
+		{
+			DeviceChoice = argv[++i];
+		}
+		else if( strcmp( argv[i], "-tune" ) == 0 )
+		{
+			Autotune = 1;
+		}
+		else if( strcmp( argv[i], "-nospecialize" ) == 0 )
+		{
+			Specialize = 0;
+		}
+		else if( strcmp( argv[i], "-fastmath" ) == 0 )
+		{
+			FastMath = 1;
+		}
+		else if( strcmp( argv[i], "-noverify" ) == 0 )
+		{
+			Verify = 0;
+		}
+		else if( strcmp( argv[i], "-seed" ) == 0 && i+1 < argc )
+		{
+			Seed = (unsigned int)strtoul( argv[++i], NULL, 10 );
+		}
+		else if( strcmp( argv[i], "-sweep" ) == 0 && i+1 < argc )
+		{
+			SweepFile = argv[++i];
+		}
+		else if( strcmp( argv[i], "-sweep-sizes" ) == 0 && i+1 < argc )
+		{
+			SweepSizes = argv[++i];
+		}
+		else if( strcmp( argv[i], "-sweep-local" ) == 0 && i+1 < argc )
+		{
+			SweepLocals = argv[++i];
+		}
+		else if( strcmp( argv[i], "-sweep-kernels" ) == 0 && i+1 < argc )
+		{
+			SweepKernels = argv[++i];
+		}
+		else if( strcmp( argv[i], "-sweep-math" ) == 0 && i+1 < argc )
+		{
+			SweepMath = argv[++i];
+		}
+		else if( strcmp( argv[i], "-trace" ) == 0 && i+1 < argc )
+		{
+			TraceFile = argv[++i];
+		}
+		else if( strcmp( argv[i], "-warmup" ) == 0 && i+1 < argc )
+		{
+			Warmup = atoi( argv[++i] );
+		}
+		else if( strcmp( argv[i], "-reps" ) == 0 && i+1 < argc )
+		{
+			Reps = atoi( argv[++i] );
+		}
+		else if( strcmp( argv[i], "-format" ) == 0 && i+1 < argc )
+		{
+			i++;
+			if( strcmp( argv[i], "text" ) == 0 )
+				Format = FORMAT_TEXT;
+			else if( strcmp( argv[i], "csv" ) == 0 )
+				Format = FORMAT_CSV;
+			else if( strcmp( argv[i], "json" ) == 0 )
+				Format = FORMAT_JSON;
+			else
+				Format = -1;
+		}
+		else if( strcmp( argv[i], "-backend" ) == 0 && i+1 < argc )
+		{
+			i++;
+			if( strcmp( argv[i], "opencl" ) == 0 )
+				Backend = BACKEND_OPENCL;
+			else if( strcmp( argv[i], "cpu" ) == 0 )
+				Backend = BACKEND_CPU;
+			else if( strcmp( argv[i], "both" ) == 0 )
+				Backend = BACKEND_BOTH;
+			else
+				Backend = -1;
+		}
+		else
+		{
+			fprintf( stderr, "Usage: %s [-m M] [-n N] [-k K] [-local N] [-tile N] [-micro RxC] [-vec 4|8] [-zerocopy|-copy] [-cache DIR|-nocache] [-kernels DIR] [-pipeline ROWS] [-ooc TILE] [-multi] [-device INDEX|NAME] [-tune] [-nospecialize] [-fastmath] [-backend opencl|cpu|both] [-noverify] [-seed N] [-warmup N] [-reps N] [-format text|csv|json] [-trace FILE] [-sweep FILE [-sweep-sizes N,...] [-sweep-local RxC,...] [-sweep-kernels NAME,...] [-sweep-math strict,fast]]\n", argv[0] );
+			return 1;
+		}
+	}
+
+	if( M <= 0 || N <= 0 || K <= 0 )
+	{
+		fprintf( stderr, "The matrix sizes (%d x %d x %d) must be positive\n", M, N, K );
+		return 1;
+	}
+
+	if( Backend < 0 )
+	{
+		fprintf( stderr, "The backend must be opencl, cpu or both\n" );
+		return 1;
+	}
+
+	if( Format < 0 )
+	{
+		fprintf( stderr, "The format must be text, csv or json\n" );
+		return 1;
+	}
+
+	if( Warmup < 0 || Reps <= 0 )
+	{
+		fprintf( stderr, "The warmup runs (%d) can't be negative and the timed runs (%d) must be positive\n", Warmup, Reps );
+		return 1;
+	}
+
+	if( LocalSize <= 0 )
+	{
+		fprintf( stderr, "The local size (%d) must be positive\n", LocalSize );
+		return 1;
+	}
+
+	if( TileSize <= 0 )
+	{
+		fprintf( stderr, "The tile size (%d) must be positive\n", TileSize );
+		return 1;
+	}
+
+	if( MicroRows <= 0 || MicroCols <= 0 )
+	{
+		fprintf( stderr, "The micro-tile size (%dx%d) must be positive\n", MicroRows, MicroCols );
+		return 1;
+	}
+
+	if( PanelRows < 0 )
+	{
+		fprintf( stderr, "The pipeline panel size (%d) can't be negative\n", PanelRows );
+		return 1;
+	}
+
+	if( OocTile < 0 )
+	{
+		fprintf( stderr, "The out-of-core tile size (%d) can't be negative\n", OocTile );
+		return 1;
+	}
+
+	if( VecWidth != 0 && VecWidth != 4 && VecWidth != 8 )
+	{
+		fprintf( stderr, "The vector width (%d) must be 4 or 8\n", VecWidth );
+		return 1;
+	}
+
+	// The CPU backend doesn't need OpenCL at all:
+
+	if( Backend == BACKEND_CPU )
+	{
+		double setup = omp_get_wtime( );
+		if( ! AllocateMatrices( MATRIX_ALIGNMENT ) )
+		{
+			fprintf( stderr, "Cannot allocate the host matrices\n" );
+			return 1;
+		}
+		ComputeReference( );
+		TraceHost( "Set up the host matrices", setup );
+		RunCpuBackend( );
+		PrintReport( );
+		WriteTrace( TraceFile );
+		return VerifyFailures > 0 ? 1 : 0;
+	}
+
+	// see if we can even get the OpenCL kernel programs
+	// (no point going on if we can't):
+
+	char *clProgramTextMatMult = GetKernelSource( CL_FILE_NAME_1 );
+	char *clProgramTextMatAdd  = GetKernelSource( CL_FILE_NAME_2 );
+	if( clProgramTextMatMult == NULL || clProgramTextMatAdd == NULL )
+	{
+		fprintf( stderr, "Cannot get OpenCL source file '%s' or '%s'\n", CL_FILE_NAME_1, CL_FILE_NAME_2 );
+		return 1;
+	}
+
+	cl_int status;		// returned status from opencl calls -- test against CL_SUCCESS
+
+
+	// Get the platform id and the device id:
+
+	double setup = omp_get_wtime( );
+	SelectOpenclDevice();		// sets the global variables Platform and Device
+	TraceHost( "Select the device", setup );
+
+	// Pick the vector width for the ...Vec kernels if it wasn't given on the command line:
+
+	if( VecWidth == 0 )
+	{
+		cl_uint preferred = 1;
+		clGetDeviceInfo( Device, CL_DEVICE_PREFERRED_VECTOR_WIDTH_FLOAT, sizeof(preferred), &preferred, NULL );
+		VecWidth = ( preferred >= 8 ) ? 8 : 4;
+		if( Format == FORMAT_TEXT )
+			fprintf( stderr, "Preferred float vector width = %d, using float%d\n", (int)preferred, VecWidth );
+	}
+
+	// Use zero-copy buffers if the device shares memory with the host and we weren't told otherwise:
+
+	if( ZeroCopy < 0 )
+	{
+		cl_bool unified = CL_FALSE;
+		clGetDeviceInfo( Device, CL_DEVICE_HOST_UNIFIED_MEMORY, sizeof(unified), &unified, NULL );
+		ZeroCopy = ( unified == CL_TRUE ) ? 1 : 0;
+	}
+	if( Format == FORMAT_TEXT )
+		fprintf( stderr, "%s\n", ZeroCopy ? "Using zero-copy buffers" : "Copying buffers to and from the device" );
+
+	// Find out how much the device can hold:
+
+	clGetDeviceInfo( Device, CL_DEVICE_GLOBAL_MEM_SIZE,    sizeof(DeviceGlobalMem), &DeviceGlobalMem, NULL );
+	clGetDeviceInfo( Device, CL_DEVICE_MAX_MEM_ALLOC_SIZE, sizeof(DeviceMaxAlloc),  &DeviceMaxAlloc,  NULL );
+	if( Format == FORMAT_TEXT )
+		fprintf( stderr, "Device memory = %.1lf MB, largest buffer = %.1lf MB\n", (double)DeviceGlobalMem / 1048576., (double)DeviceMaxAlloc / 1048576. );
+
+
+	// 2. Allocate the host memory buffers:
+	// (dA and dB are also the M x N operands of MatrixAdd, so they are made big enough for that too)
+	// (zero-copy buffers wrap the host matrices, so those have to be page aligned)
+
+	setup = omp_get_wtime( );
+	if( ! AllocateMatrices( ZeroCopy ? PAGE_ALIGNMENT : MATRIX_ALIGNMENT ) )
+	{
+		fprintf( stderr, "Cannot allocate the host matrices\n" );
+		return 1;
+	}
+	ComputeReference( );
+	TraceHost( "Set up the host matrices", setup );
+
+	// If all three matrices can't be on the device at once, only the out-of-core product can be run:
+
+	bool inCore = hA.Bytes <= DeviceMaxAlloc && hB.Bytes <= DeviceMaxAlloc && hC.Bytes <= DeviceMaxAlloc
+			   && hA.Bytes + hB.Bytes + hC.Bytes <= DeviceGlobalMem;
+	if( ! inCore )
+		fprintf( stderr, "The matrices are too big for the device -- only running the out-of-core product\n" );
+
+	// 3. Create an OpenCL context:
+
+	setup = omp_get_wtime( );
+	Context = ocl::Context( Device );
+
+
+	// 4. Create an OpenCL command queue:
+
+	CmdQueue = ocl::Queue( Context, Device, CL_QUEUE_PROFILING_ENABLE );
+	NameQueue( CmdQueue, "Commands" );
+	Pool.Init( Context );
+	TraceHost( "Create context and queue", setup );
+
+
+	// 5. Allocate the GPU device memory buffers for the A, B and C matrices:
+	// (they are borrowed from the buffer pool -- in zero-copy mode they are built on the host matrices themselves instead)
+
+	size_t aSize = hA.Bytes;
+	size_t bSize = hB.Bytes;
+	size_t cSize = hC.Bytes;
+	cl_mem_flags hostFlags = ZeroCopy ? CL_MEM_USE_HOST_PTR : 0;
+
+	ocl::PooledBuffer dA, dB, dC;
+	if( inCore )
+	{
+		// Allocating device memory for the A matrix
+		dA = Pool.Acquire( CL_MEM_READ_ONLY | hostFlags, aSize, ZeroCopy ? hA.Data : NULL, "dA" );
+
+		// Allocating device memory for the B matrix
+		dB = Pool.Acquire( CL_MEM_READ_ONLY | hostFlags, bSize, ZeroCopy ? hB.Data : NULL, "dB" );
+
+		// Allocating device memory for the C matrix
+		// (read-write, since the GEMM kernels read it back in when beta isn't 0)
+		dC = Pool.Acquire( CL_MEM_READ_WRITE | hostFlags, cSize, ZeroCopy ? hC.Data : NULL, "dC" );
+	}
+
+	// 6. Enqueue the 2 commands to write the data from the host buffers to the device buffers:
+	// (nothing to do in zero-copy mode -- the device already sees the host matrices)
+	// (the host doesn't wait for them -- the kernels below have them in their wait lists instead)
+
+	Pending writeA, writeB;
+	std::vector<cl_event> inputs;
+
+	if( inCore && ! ZeroCopy )
+	{
+		cl_event write = NULL;
+
+		// Enqueue the data from matrix A to the device.
+		status = clEnqueueWriteBuffer( CmdQueue, dA, CL_FALSE, 0, aSize, hA.Data, 0, NULL, &write );
+		if( status != CL_SUCCESS )
+			fprintf( stderr, "clEnqueueWriteBuffer failed for martix A (1)\n" );
+		writeA = Pending( write, STAGE_H2D, "Write dA" );
+
+		// Enqueue the data from matrix B to the device.
+		write = NULL;
+		status = clEnqueueWriteBuffer( CmdQueue, dB, CL_FALSE, 0, bSize, hB.Data, 0, NULL, &write );
+		if( status != CL_SUCCESS )
+			fprintf( stderr, "clEnqueueWriteBuffer failed for matrix B (1)\n" );
+		writeB = Pending( write, STAGE_H2D, "Write dB" );
+
+		if( writeA.Event( ) != NULL )
+			inputs.push_back( writeA.Event( ) );
+		if( writeB.Event( ) != NULL )
+			inputs.push_back( writeB.Event( ) );
+	}
+
+
+	// This code is for the MatrixMult and MatrixAdd GPU parallelization functions.
+	// 7. The kernel code from the matrix_mult.cl and matrix_add.cl files was fetched at the start ...
+
+	// ... and create the kernel program:
+	// 8. Compile and link the kernel code:
+	// (or load it from the cache if these sources were already built with these options on this device)
+
+	char options[256];
+	KernelOptions( options, sizeof(options), K );
+
+	ProgramSources[0] = clProgramTextMatMult;	// Add both the MatrixMult and MatrixAdd kernels to the list of string pointers
+	ProgramSources[1] = clProgramTextMatAdd;	// for use with creating the program.
+	UseProgram( K );																	// IMPORTANT: Multiple kernel .cl files can be read in.
+	if( MultiDevice )
+	{
+		setup = omp_get_wtime( );
+		SetupWorkers( (const char **)ProgramSources, 2, options );							// ... and build them for every device too
+		TraceHost( "Set up the multi-device workers", setup );
+	}
+	// (the sources are kept, since the autotuner and the tuned settings can need builds with other options)
+
+	// the settings from the command line, which every kernel runs with unless it has tuned ones
+	// (the sweep starts from these too):
+
+	DefaultConfig.LocalSize = LocalSize;
+	DefaultConfig.TileSize  = TileSize;
+	DefaultConfig.VecWidth  = VecWidth;
+	DefaultConfig.MicroRows = MicroRows;
+	DefaultConfig.MicroCols = MicroCols;
+
+	// A sweep takes the place of the usual runs:
+	// (it gets its own buffers for each size)
+
+	if( SweepFile != NULL )
+	{
+		writeA.Get( );
+		writeB.Get( );
+		dA.Reset( );
+		dB.Reset( );
+		dC.Reset( );
+		bool swept = RunSweep( SweepFile );
+		WriteTrace( TraceFile );
+		ReleaseAll( );
+		return ( swept && VerifyFailures == 0 ) ? 0 : 1;
+	}
+
+	// Look up the settings for this device and these sizes in the tuning database
+	// (or find them, if we were asked to):
+
+	if( UseTuning )
+		LoadTuning( M, N, K );
+
+	if( Autotune && inCore )
+	{
+		setup = omp_get_wtime( );
+		size_t timings = Timings.size( );
+		Quiet = true;
+		Tune( "MatrixMult",        M, N, K, dA, hA.Ld, dB, hB.Ld, dC, hC.Ld );
+		Tune( "MatrixMultTiled",   M, N, K, dA, hA.Ld, dB, hB.Ld, dC, hC.Ld );
+		Tune( "MatrixMultBlocked", M, N, K, dA, hA.Ld, dB, hB.Ld, dC, hC.Ld );
+		Tune( "MatrixMultVec",     M, N, K, dA, hA.Ld, dB, hB.Ld, dC, hC.Ld );
+		Tune( "MatrixAdd",         M, N, 0, dA, hA.Ld, dB, hB.Ld, dC, hC.Ld );
+		Tune( "MatrixAddVec",      M, N, 0, dA, hA.Ld, dB, hB.Ld, dC, hC.Ld );
+		Quiet = false;
+		Timings.resize( timings );		// (the trial runs don't belong in the report)
+		SaveTuning( M, N, K );
+		TraceHost( "Autotune", setup );
+	}
+
+
+	// 9.-12. Run each of the kernels on the same dA, dB and dC buffers:
+	// (the device buffers are copies of the host matrices, so they have the same leading dimensions)
+	// (each one is run Warmup + Reps times -- beta is 0, so every run leaves the same dC behind)
+
+	BenchStats stats;
+	if( inCore )
+	{
+		if( KernelFits( "MatrixMult", K ) )
+		{
+			ClearResults( dC );
+			stats = Benchmark( [&]( ) { return Gemm( "MatrixMult", M, N, K, 1.f, dA, hA.Ld, dB, hB.Ld, 0.f, dC, hC.Ld, inputs ); } );
+			ReadResults( dC );
+			PrintResults( "MatrixMult", "Matrix Multiplication", LocalSize, M, N, K, stats, true );		// the others should match it
+			VerifyResults( "MatrixMult", false );
+			ReleaseResults( dC );
+			CheckGemm( "MatrixMult", dC, [&]( ) { Gemm( "MatrixMult", M, N, K, GEMM_ALPHA, dA, hA.Ld, dB, hB.Ld, GEMM_BETA, dC, hC.Ld, inputs ).Get( ); } );
+		}
+
+		if( KernelFits( "MatrixMultTiled", K ) )
+		{
+			ClearResults( dC );
+			stats = Benchmark( [&]( ) { return Gemm( "MatrixMultTiled", M, N, K, 1.f, dA, hA.Ld, dB, hB.Ld, 0.f, dC, hC.Ld, inputs ); } );
+			ReadResults( dC );
+			PrintResults( "MatrixMultTiled", "Tiled Matrix Multiplication", TileSize, M, N, K, stats, true );	// should match MatrixMult
+			VerifyResults( "MatrixMultTiled", false );
+			ReleaseResults( dC );
+			CheckGemm( "MatrixMultTiled", dC, [&]( ) { Gemm( "MatrixMultTiled", M, N, K, GEMM_ALPHA, dA, hA.Ld, dB, hB.Ld, GEMM_BETA, dC, hC.Ld, inputs ).Get( ); } );
+		}
+
+		if( KernelFits( "MatrixMultBlocked", K ) )
+		{
+			ClearResults( dC );
+			stats = Benchmark( [&]( ) { return Gemm( "MatrixMultBlocked", M, N, K, 1.f, dA, hA.Ld, dB, hB.Ld, 0.f, dC, hC.Ld, inputs ); } );
+			ReadResults( dC );
+			PrintResults( "MatrixMultBlocked", "Register-Blocked Matrix Multiplication", LocalSize, M, N, K, stats, true );	// should match MatrixMult
+			VerifyResults( "MatrixMultBlocked", false );
+			ReleaseResults( dC );
+			CheckGemm( "MatrixMultBlocked", dC, [&]( ) { Gemm( "MatrixMultBlocked", M, N, K, GEMM_ALPHA, dA, hA.Ld, dB, hB.Ld, GEMM_BETA, dC, hC.Ld, inputs ).Get( ); } );
+		}
+
+		if( KernelFits( "MatrixMultVec", K ) )
+		{
+			ClearResults( dC );
+			stats = Benchmark( [&]( ) { return Gemm( "MatrixMultVec", M, N, K, 1.f, dA, hA.Ld, dB, hB.Ld, 0.f, dC, hC.Ld, inputs ); } );
+			ReadResults( dC );
+			PrintResults( "MatrixMultVec", "Vector Matrix Multiplication", LocalSize, M, N, K, stats, true );	// should match MatrixMult
+			VerifyResults( "MatrixMultVec", false );
+			ReleaseResults( dC );
+			CheckGemm( "MatrixMultVec", dC, [&]( ) { Gemm( "MatrixMultVec", M, N, K, GEMM_ALPHA, dA, hA.Ld, dB, hB.Ld, GEMM_BETA, dC, hC.Ld, inputs ).Get( ); } );
+		}
+
+		if( KernelFits( "MatrixAdd", 0 ) )
+		{
+			ClearResults( dC );
+			stats = Benchmark( [&]( ) { return MatAdd( "MatrixAdd", M, N, dA, hA.Ld, dB, hB.Ld, dC, hC.Ld, inputs ); } );
+			ReadResults( dC );
+			PrintResults( "MatrixAdd", "Matrix Addition", LocalSize, M, N, 0, stats, true );				// the next one should match it
+			VerifyResults( "MatrixAdd", true );
+			ReleaseResults( dC );
+		}
+
+		if( KernelFits( "MatrixAddVec", 0 ) )
+		{
+			ClearResults( dC );
+			stats = Benchmark( [&]( ) { return MatAdd( "MatrixAddVec", M, N, dA, hA.Ld, dB, hB.Ld, dC, hC.Ld, inputs ); } );
+			ReadResults( dC );
+			PrintResults( "MatrixAddVec", "Vector Matrix Addition", LocalSize, M, N, 0, stats, true );		// should match MatrixAdd
+			VerifyResults( "MatrixAddVec", true );
+			ReleaseResults( dC );
+		}
+	}
+
+	// (the pipeline keeps all of B on the device, so it can't run when the matrices don't fit either)
+
+	if( PanelRows > 0 && ! inCore )
+		fprintf( stderr, "The matrices are too big for the device -- leaving out the pipelined product\n" );
+	if( PanelRows > 0 && inCore && KernelFits( "MatrixMultTiled", K ) )
+	{
+		// (this one moves its own panels between hA, hB, hC and the device, so the time includes the transfers)
+
+		ClearResults( NULL );
+		stats = Benchmark( [&]( ) { return PipelinedGemm( "MatrixMultTiled", PanelRows, M, N, K, 1.f, hA, hB, 0.f, hC ); } );
+		PrintResults( "Pipelined MatrixMultTiled", "Pipelined Matrix Multiplication", TileSize, M, N, K, stats, false );	// should match MatrixMult
+		VerifyResults( "Pipelined MatrixMultTiled", false );
+		CheckGemm( "Pipelined MatrixMultTiled", NULL, [&]( ) { PipelinedGemm( "MatrixMultTiled", PanelRows, M, N, K, GEMM_ALPHA, hA, hB, GEMM_BETA, hC ); } );
+	}
+
+	if( ! inCore || OocTile > 0 )
+	{
+		// (this one streams tiles of hA, hB and hC through the device, so the time includes the transfers)
+
+		int tile = OocTile > 0 ? OocTile : OutOfCoreTile( M, N, K );
+		if( KernelFits( "MatrixMultTiled", K % tile == 0 ? tile : 0 ) )		// (the k OutOfCoreGemm( ) builds it for)
+		{
+			ClearResults( NULL );
+			stats = Benchmark( [&]( ) { return OutOfCoreGemm( "MatrixMultTiled", tile, M, N, K, 1.f, hA, hB, 0.f, hC ); } );
+			PrintResults( "Out-of-Core MatrixMultTiled", "Out-of-Core Matrix Multiplication", TileSize, M, N, K, stats, false );	// should match MatrixMult
+			VerifyResults( "Out-of-Core MatrixMultTiled", false );
+			CheckGemm( "Out-of-Core MatrixMultTiled", NULL, [&]( ) { OutOfCoreGemm( "MatrixMultTiled", tile, M, N, K, GEMM_ALPHA, hA, hB, GEMM_BETA, hC ); } );
+		}
+	}
+
+	if( MultiDevice )
+	{
+		// (each device gets its own copies of its rows, so these times include the transfers too)
+
+		ClearResults( NULL );
+		SplitRows( "MatrixMult", M, N, K, 1.f, hA, hB, 0.f, hC );
+		stats = Benchmark( [&]( ) { return MultiDeviceRun( "MatrixMult", M, N, K, 1.f, hA, hB, 0.f, hC ); } );
+		PrintResults( "Multi-Device MatrixMult", "Multi-Device Matrix Multiplication", LocalSize, M, N, K, stats, false );	// should match MatrixMult
+		VerifyResults( "Multi-Device MatrixMult", false );
+		CheckGemm( "Multi-Device MatrixMult", NULL, [&]( ) { MultiDeviceRun( "MatrixMult", M, N, K, GEMM_ALPHA, hA, hB, GEMM_BETA, hC ); } );
+
+		ClearResults( NULL );
+		SplitRows( "MatrixAdd", M, N, 0, 1.f, hA, hB, 0.f, hC );
+		stats = Benchmark( [&]( ) { return MultiDeviceRun( "MatrixAdd", M, N, 0, 1.f, hA, hB, 0.f, hC ); } );
+		PrintResults( "Multi-Device MatrixAdd", "Multi-Device Matrix Addition", LocalSize, M, N, 0, stats, false );		// should match MatrixAdd
+		VerifyResults( "Multi-Device MatrixAdd", true );
+	}
+
+	if( Backend == BACKEND_BOTH )
+		RunCpuBackend( );
+
+	writeA.Get( );
+	writeB.Get( );
+	Settle( );
+	PrintTimings( );
+	PrintReport( );
+	WriteTrace( TraceFile );
+
+	// 13. clean everything up:
+
+	// (the buffers go back to the pool, which then releases them along with the rest of the globals)
+
+	dA.Reset( );
+	dB.Reset( );
+	dC.Reset( );
+	ReleaseAll( );
+
+	if( VerifyFailures > 0 )
+		fprintf( stderr, "%d results failed verification\n", VerifyFailures );
+	return VerifyFailures > 0 ? 1 : 0;
+}
+
+
+// run one of the MatrixMult... kernels to compute dC = alpha * dA * dB + beta * dC, where
+// dC is m x n, dA is m x k and dB is k x n, and each has its rows ld... floats apart
+// none of the sizes need to be multiples of the local work size -- the global work size is
+// rounded up and the kernels skip the extra work-items
+// the kernel waits for the commands in after (as well as everything before it on CmdQueue), and this returns
+// as soon as it is enqueued -- the result's Get( ) gives the kernel execution time in seconds:
+
+Pending Gemm( const char *name, int m, int n, int k, float alpha, cl_mem dA, int lda, cl_mem dB, int ldb, float beta, cl_mem dC, int ldc, const std::vector<cl_event> &after )
+{
+	UseConfig( name, k );
+
+	// 9. Create the kernel object:
+	// (or pick it up from Kernels, if it has been made before)
+
+	cl_kernel kernel = ProgramKernel( name );
+
+
+	// 10. setup the arguments to the kernel object:
+
+	SetGemmArgs( kernel, m, n, k, alpha, dA, lda, dB, ldb, beta, dC, ldc );
+
+
+	// 11. enqueue the kernel object for execution:
+
+	size_t globalWorkSize[3], localWorkSize[3];
+	GemmWorkSize( name, m, n, globalWorkSize, localWorkSize );
+
+	return RunKernel( kernel, name, globalWorkSize, localWorkSize, after );
+}
+
+
+// set the arguments of one of the MatrixMult... kernels
+// (the matrix dimensions are passed by value so the kernels don't need to read them from a buffer):
+
+void SetGemmArgs( cl_kernel kernel, int m, int n, int k, float alpha, cl_mem dA, int lda, cl_mem dB, int ldb, float beta, cl_mem dC, int ldc )
+{
+	SetKernelArg( kernel,  0, sizeof(int),    &m,     "m" );
+	SetKernelArg( kernel,  1, sizeof(int),    &n,     "n" );
+	SetKernelArg( kernel,  2, sizeof(int),    &k,     "k" );
+	SetKernelArg( kernel,  3, sizeof(float),  &alpha, "alpha" );
+	SetKernelArg( kernel,  4, sizeof(cl_mem), &dA,    "dA" );
+	SetKernelArg( kernel,  5, sizeof(int),    &lda,   "lda" );
+	SetKernelArg( kernel,  6, sizeof(cl_mem), &dB,    "dB" );
+	SetKernelArg( kernel,  7, sizeof(int),    &ldb,   "ldb" );
+	SetKernelArg( kernel,  8, sizeof(float),  &beta,  "beta" );
+	SetKernelArg( kernel,  9, sizeof(cl_mem), &dC,    "dC" );
+	SetKernelArg( kernel, 10, sizeof(int),    &ldc,   "ldc" );
+}
+
+
+// the global and local work sizes that one of the MatrixMult... kernels needs to cover an m x n dC
+// (each variant covers dC with a different number of work-items):
+
+void GemmWorkSize( const char *name, int m, int n, size_t *globalWorkSize, size_t *localWorkSize )
+{
+	int localCols = ( LocalCols > 0 ) ? LocalCols : LocalSize;
+	globalWorkSize[0] = RoundUp( m, LocalSize );
+	globalWorkSize[1] = RoundUp( n, localCols );
+	globalWorkSize[2] = 1;
+	localWorkSize[0] = LocalSize;
+	localWorkSize[1] = localCols;
+	localWorkSize[2] = 1;
+
+	if( strcmp( name, "MatrixMultTiled" ) == 0 )			// one TileSize x TileSize work-group per tile
+	{
+		globalWorkSize[0] = RoundUp( m, TileSize );
+		globalWorkSize[1] = RoundUp( n, TileSize );
+		localWorkSize[0] = localWorkSize[1] = TileSize;
+	}
+	else if( strcmp( name, "MatrixMultBlocked" ) == 0 )	// one work-item per micro-tile
+	{
+		globalWorkSize[0] = RoundUp( (m+MicroRows-1)/MicroRows, LocalSize );
+		globalWorkSize[1] = RoundUp( (n+MicroCols-1)/MicroCols, localCols );
+	}
+	else if( strcmp( name, "MatrixMultVec" ) == 0 )		// one work-item per vector (plus the tail)
+	{
+		globalWorkSize[1] = RoundUp( (n+VecWidth-1)/VecWidth, localCols );
+	}
+}
+
+
+// compute c = alpha * a * b + beta * c for the host matrices (c is m x n, a is m x k, b is k x n),
+// moving c through the device panelRows rows at a time with the transfers on their own queues,
+// so they overlap the kernels instead of taking turns with them:
+//		the upload queue:	b once, then each panel of a (and of c, if beta isn't 0)
+//		CmdQueue:			the kernel for each panel, as soon as its upload is done
+//		the download queue:	each panel of c, as soon as its kernel is done
+// while panel p runs, panel p+1 is being uploaded and panel p-1 downloaded
+// each panel uses one of PIPELINE_SLOTS sets of device buffers, so panel p also has to wait for
+// panel p-PIPELINE_SLOTS to be done with that set before its upload or kernel can start
+// only b and PIPELINE_SLOTS panels of a and c are ever on the device, so m can be larger than fits there
+// returns the time from the first upload starting to the last download finishing, in seconds:
+
+double PipelinedGemm( const char *name, int panelRows, int m, int n, int k, float alpha, Matrix &a, Matrix &b, float beta, Matrix &c )
+{
+	cl_int status;
+	UseConfig( name, k );
+
+	ocl::Queue uploads( Context, Device, CL_QUEUE_PROFILING_ENABLE );
+	ocl::Queue downloads( Context, Device, CL_QUEUE_PROFILING_ENABLE );
+	NameQueue( uploads, "Uploads" );
+	NameQueue( downloads, "Downloads" );
+	cl_kernel kernel = ProgramKernel( name );
+
+	size_t bBytes      = (size_t)k * b.Ld * sizeof(float);
+	size_t aPanelBytes = (size_t)panelRows * a.Ld * sizeof(float);
+	size_t cPanelBytes = (size_t)panelRows * c.Ld * sizeof(float);
+
+	ocl::PooledBuffer dB = Pool.Acquire( CL_MEM_READ_ONLY, bBytes, NULL, "dB" );
+	ocl::PooledBuffer dA[PIPELINE_SLOTS];
+	ocl::PooledBuffer dC[PIPELINE_SLOTS];
+	for( int s = 0; s < PIPELINE_SLOTS; s++ )
+	{
+		dA[s] = Pool.Acquire( CL_MEM_READ_ONLY,  aPanelBytes, NULL, "a dA panel" );
+		dC[s] = Pool.Acquire( CL_MEM_READ_WRITE, cPanelBytes, NULL, "a dC panel" );
+	}
+
+	int numPanels = ( m + panelRows - 1 ) / panelRows;
+	std::vector<cl_event> writeA( numPanels, (cl_event)NULL );
+	std::vector<cl_event> writeC( numPanels, (cl_event)NULL );
+	std::vector<cl_event> runs(   numPanels, (cl_event)NULL );
+	std::vector<cl_event> reads(  numPanels, (cl_event)NULL );
+
+	cl_event writeB = NULL;
+	status = clEnqueueWriteBuffer( uploads, dB, CL_FALSE, 0, bBytes, b.Data, 0, NULL, &writeB );
+	if( status != CL_SUCCESS )
+		fprintf( stderr, "clEnqueueWriteBuffer failed for matrix B (2)\n" );
+
+	for( int p = 0; p < numPanels; p++ )
+	{
+		int s = p % PIPELINE_SLOTS;
+		int row0 = p * panelRows;
+		int rows = ( m - row0 < panelRows ) ? m - row0 : panelRows;
+
+		// the panels that used this slot last time have to be done with it:
+
+		cl_event *lastRun  = ( p >= PIPELINE_SLOTS ) ? &runs[p-PIPELINE_SLOTS]  : NULL;
+		cl_event *lastRead = ( p >= PIPELINE_SLOTS ) ? &reads[p-PIPELINE_SLOTS] : NULL;
+
+		// upload this panel of a (and c):
+
+		status = clEnqueueWriteBuffer( uploads, dA[s], CL_FALSE, 0, (size_t)rows * a.Ld * sizeof(float), a[row0],
+				lastRun != NULL ? 1 : 0, lastRun, &writeA[p] );
+		if( status != CL_SUCCESS )
+			fprintf( stderr, "clEnqueueWriteBuffer failed for a panel of matrix A\n" );
+
+		if( beta != 0.f )
+		{
+			status = clEnqueueWriteBuffer( uploads, dC[s], CL_FALSE, 0, (size_t)rows * c.Ld * sizeof(float), c[row0],
+					lastRead != NULL ? 1 : 0, lastRead, &writeC[p] );
+			if( status != CL_SUCCESS )
+				fprintf( stderr, "clEnqueueWriteBuffer failed for a panel of matrix C\n" );
+		}
+		clFlush( uploads );
+
+		// run the kernel on it once b and the panel are up and the last panel in this slot has been read back:
+
+		cl_event waitFor[4];
+		int numWaits = 0;
+		waitFor[numWaits++] = writeB;
+		waitFor[numWaits++] = writeA[p];
+		if( writeC[p] != NULL )
+			waitFor[numWaits++] = writeC[p];
+		if( lastRead != NULL )
+			waitFor[numWaits++] = *lastRead;
+
+		SetGemmArgs( kernel, rows, n, k, alpha, dA[s], a.Ld, dB, b.Ld, beta, dC[s], c.Ld );
+
+		size_t globalWorkSize[3], localWorkSize[3];
+		GemmWorkSize( name, rows, n, globalWorkSize, localWorkSize );
+
+		status = clEnqueueNDRangeKernel( CmdQueue, kernel, 2, NULL, globalWorkSize, localWorkSize, numWaits, waitFor, &runs[p] );
+		if( status != CL_SUCCESS )
+			fprintf( stderr, "clEnqueueNDRangeKernel failed: %d\n", status );
+		clFlush( CmdQueue );
+
+		// and download the results as soon as the kernel is done:
+
+		status = clEnqueueReadBuffer( downloads, dC[s], CL_FALSE, 0, (size_t)rows * c.Ld * sizeof(float), c[row0], 1, &runs[p], &reads[p] );
+		if( status != CL_SUCCESS )
+			fprintf( stderr, "clEnqueueReadBuffer failed for a panel of matrix C\n" );
+		clFlush( downloads );
+	}
+
+	clFinish( uploads );
+	clFinish( CmdQueue );
+	clFinish( downloads );
+
+	// the time runs from the first command starting to the last one finishing:
+
+	cl_ulong first = EventTime( writeB, CL_PROFILING_COMMAND_START );
+	cl_ulong last = first;
+	for( int p = 0; p < numPanels; p++ )
+	{
+		cl_ulong end = EventTime( reads[p], CL_PROFILING_COMMAND_END );
+		if( end > last )
+			last = end;
+	}
+
+	RecordEvent( writeB, STAGE_H2D, "Write dB" );
+	for( int p = 0; p < numPanels; p++ )
+	{
+		RecordEvent( writeA[p], STAGE_H2D,    "Write dA panel" );
+		RecordEvent( writeC[p], STAGE_H2D,    "Write dC panel" );
+		RecordEvent( runs[p],   STAGE_KERNEL, name );
+		RecordEvent( reads[p],  STAGE_D2H,    "Read dC panel" );
+	}
+
+	return (double)( last - first ) / 1000000000.;
+}
+
+
+// the largest out-of-core tile (a multiple of 64 floats on a side) whose six buffers -- two each for
+// a, b and c -- fit in half of the device memory, with each one no bigger than the largest allowed buffer
+// (the other half is left for whatever else is using the device):
+
+int OutOfCoreTile( int m, int n, int k )
+{
+	int largest = m;
+	if( n > largest )	largest = n;
+	if( k > largest )	largest = k;
+	largest = (int)RoundUp( largest, 64 );
+
+	int tile = 64;
+	while( tile + 64 <= largest )
+	{
+		size_t bytes = ocl::BufferPool::SizeClass( (size_t)( tile + 64 ) * ( tile + 64 ) * sizeof(float) );
+		if( 6 * bytes > DeviceGlobalMem / 2  ||  bytes > DeviceMaxAlloc )
+			break;
+		tile += 64;
+	}
+	return tile;
+}
+
+
+// compute c = alpha * a * b + beta * c for the host matrices (c is m x n, a is m x k, b is k x n)
+// when they are too big to be on the device at the same time:
+// c is done one tile x tile tile at a time, and each of its tiles is the sum over the tiles along k of
+//		c(i,j) = alpha * a(i,kk) * b(kk,j) + ( kk == 0 ? beta * c(i,j) : c(i,j) )
+// so only one tile each of a, b and c has to be on the device for any one kernel
+// there are two device buffers for each, so the next tiles of a and b are uploaded (and the last tile of c
+// downloaded) while the kernel works on this one -- the transfers go on their own queues, like in PipelinedGemm( )
+// the tiles are packed into the device buffers (tile floats per row) with the rectangular read and write calls,
+// so the host matrices don't need to be copied first
+// returns the time from the first upload starting to the last download finishing, in seconds:
+
+double OutOfCoreGemm( const char *name, int tile, int m, int n, int k, float alpha, Matrix &a, Matrix &b, float beta, Matrix &c )
+{
+	cl_int status;
+	UseConfig( name, k % tile == 0 ? tile : 0 );		// (every kernel runs on a whole tile of k, unless the last one is short)
+
+	ocl::Queue uploads( Context, Device, CL_QUEUE_PROFILING_ENABLE );
+	ocl::Queue downloads( Context, Device, CL_QUEUE_PROFILING_ENABLE );
+	NameQueue( uploads, "Uploads" );
+	NameQueue( downloads, "Downloads" );
+	cl_kernel kernel = ProgramKernel( name );
+
+	size_t tileBytes = (size_t)tile * tile * sizeof(float);
+	ocl::PooledBuffer dA[2], dB[2], dC[2];
+	for( int s = 0; s < 2; s++ )
+	{
+		dA[s] = Pool.Acquire( CL_MEM_READ_ONLY,  tileBytes, NULL, "a dA tile" );
+		dB[s] = Pool.Acquire( CL_MEM_READ_ONLY,  tileBytes, NULL, "a dB tile" );
+		dC[s] = Pool.Acquire( CL_MEM_READ_WRITE, tileBytes, NULL, "a dC tile" );
+	}
+
+	int rowTiles = ( m + tile - 1 ) / tile;
+	int colTiles = ( n + tile - 1 ) / tile;
+	int kTiles   = ( k + tile - 1 ) / tile;
+	int numTiles = rowTiles * colTiles;
+	int numSteps = numTiles * kTiles;
+
+	std::vector<cl_event> writeA( numSteps, (cl_event)NULL );
+	std::vector<cl_event> writeB( numSteps, (cl_event)NULL );
+	std::vector<cl_event> runs(   numSteps, (cl_event)NULL );
+	std::vector<cl_event> writeC( numTiles, (cl_event)NULL );
+	std::vector<cl_event> reads(  numTiles, (cl_event)NULL );
+
+	size_t devOrigin[3] = { 0, 0, 0 };
+	size_t devPitch = (size_t)tile * sizeof(float);
+
+	int t = 0;												// which step (kernel) this is
+	for( int q = 0; q < numTiles; q++ )
+	{
+		int row0 = ( q / colTiles ) * tile;
+		int col0 = ( q % colTiles ) * tile;
+		int rows = ( m - row0 < tile ) ? m - row0 : tile;
+		int cols = ( n - col0 < tile ) ? n - col0 : tile;
+		int cs = q % 2;
+
+		// the tile of c that used this buffer last time has to be read back before this one can use it:
+
+		cl_event *lastRead = ( q >= 2 ) ? &reads[q-2] : NULL;
+
+		if( beta != 0.f )
+		{
+			size_t hostOrigin[3] = { (size_t)col0 * sizeof(float), (size_t)row0, 0 };
+			size_t region[3]     = { (size_t)cols * sizeof(float), (size_t)rows, 1 };
+			status = clEnqueueWriteBufferRect( uploads, dC[cs], CL_FALSE, devOrigin, hostOrigin, region, devPitch, 0,
+					(size_t)c.Ld * sizeof(float), 0, c.Data, lastRead != NULL ? 1 : 0, lastRead, &writeC[q] );
+			if( status != CL_SUCCESS )
+				fprintf( stderr, "clEnqueueWriteBufferRect failed for a tile of matrix C (%d)\n", status );
+		}
+
+		for( int kk = 0; kk < kTiles; kk++, t++ )
+		{
+			int k0 = kk * tile;
+			int depth = ( k - k0 < tile ) ? k - k0 : tile;
+			int s = t % 2;
+
+			// the kernel two steps back has to be done with these a and b buffers:
+
+			cl_event *lastRun = ( t >= 2 ) ? &runs[t-2] : NULL;
+
+			size_t aOrigin[3] = { (size_t)k0 * sizeof(float), (size_t)row0, 0 };
+			size_t aRegion[3] = { (size_t)depth * sizeof(float), (size_t)rows, 1 };
+			status = clEnqueueWriteBufferRect( uploads, dA[s], CL_FALSE, devOrigin, aOrigin, aRegion, devPitch, 0,
+					(size_t)a.Ld * sizeof(float), 0, a.Data, lastRun != NULL ? 1 : 0, lastRun, &writeA[t] );
+			if( status != CL_SUCCESS )
+				fprintf( stderr, "clEnqueueWriteBufferRect failed for a tile of matrix A (%d)\n", status );
+
+			size_t bOrigin[3] = { (size_t)col0 * sizeof(float), (size_t)k0, 0 };
+			size_t bRegion[3] = { (size_t)cols * sizeof(float), (size_t)depth, 1 };
+			status = clEnqueueWriteBufferRect( uploads, dB[s], CL_FALSE, devOrigin, bOrigin, bRegion, devPitch, 0,
+					(size_t)b.Ld * sizeof(float), 0, b.Data, lastRun != NULL ? 1 : 0, lastRun, &writeB[t] );
+			if( status != CL_SUCCESS )
+				fprintf( stderr, "clEnqueueWriteBufferRect failed for a tile of matrix B (%d)\n", status );
+			clFlush( uploads );
+
+			// the first kernel for a tile of c applies beta and the rest add on to what is already there
+			// (the kernels for one tile follow each other on CmdQueue, so they don't need to wait for each other):
+
+			cl_event waitFor[4];
+			int numWaits = 0;
+			waitFor[numWaits++] = writeA[t];
+			waitFor[numWaits++] = writeB[t];
+			if( kk == 0 && writeC[q] != NULL )
+				waitFor[numWaits++] = writeC[q];
+			if( kk == 0 && lastRead != NULL )
+				waitFor[numWaits++] = *lastRead;
+
+			SetGemmArgs( kernel, rows, cols, depth, alpha, dA[s], tile, dB[s], tile, kk == 0 ? beta : 1.f, dC[cs], tile );
+
+			size_t globalWorkSize[3], localWorkSize[3];
+			GemmWorkSize( name, rows, cols, globalWorkSize, localWorkSize );
+
+			status = clEnqueueNDRangeKernel( CmdQueue, kernel, 2, NULL, globalWorkSize, localWorkSize, numWaits, waitFor, &runs[t] );
+			if( status != CL_SUCCESS )
+				fprintf( stderr, "clEnqueueNDRangeKernel failed: %d\n", status );
+			clFlush( CmdQueue );
+		}
+
+		// download the finished tile of c as soon as its last kernel is done:
+
+		size_t hostOrigin[3] = { (size_t)col0 * sizeof(float), (size_t)row0, 0 };
+		size_t region[3]     = { (size_t)cols * sizeof(float), (size_t)rows, 1 };
+		status = clEnqueueReadBufferRect( downloads, dC[cs], CL_FALSE, devOrigin, hostOrigin, region, devPitch, 0,
+				(size_t)c.Ld * sizeof(float), 0, c.Data, 1, &runs[t-1], &reads[q] );
+		if( status != CL_SUCCESS )
+			fprintf( stderr, "clEnqueueReadBufferRect failed for a tile of matrix C (%d)\n", status );
+		clFlush( downloads );
+	}
+
+	clFinish( uploads );
+	clFinish( CmdQueue );
+	clFinish( downloads );
+
+	// the time runs from the first command starting to the last one finishing:
+
+	cl_ulong first = EventTime( writeC[0] != NULL ? writeC[0] : writeA[0], CL_PROFILING_COMMAND_START );
+	cl_ulong last = first;
+	for( int q = 0; q < numTiles; q++ )
+	{
+		cl_ulong end = EventTime( reads[q], CL_PROFILING_COMMAND_END );
+		if( end > last )
+			last = end;
+	}
+
+	for( int q = 0; q < numTiles; q++ )
+	{
+		RecordEvent( writeC[q], STAGE_H2D, "Write dC tile" );
+		RecordEvent( reads[q],  STAGE_D2H, "Read dC tile" );
+	}
+	for( int i = 0; i < numSteps; i++ )
+	{
+		RecordEvent( writeA[i], STAGE_H2D,    "Write dA tile" );
+		RecordEvent( writeB[i], STAGE_H2D,    "Write dB tile" );
+		RecordEvent( runs[i],   STAGE_KERNEL, name );
+	}
+
+	return (double)( last - first ) / 1000000000.;
+}
+
+
+// run one of the MatrixAdd... kernels to compute dC = dA + dB, where all three are m x n
+// and each has its rows ld... floats apart
+// returns the kernel execution time in seconds:
+
+Pending MatAdd( const char *name, int m, int n, cl_mem dA, int lda, cl_mem dB, int ldb, cl_mem dC, int ldc, const std::vector<cl_event> &after )
+{
+	UseConfig( name, 0 );
+
+	// 9. Create the kernel object:
+	// (or pick it up from Kernels, if it has been made before)
+
+	cl_kernel kernel = ProgramKernel( name );
+
+
+	// 10. setup the arguments to the kernel object:
+
+	SetAddArgs( kernel, m, n, dA, lda, dB, ldb, dC, ldc );
+
+
+	// 11. enqueue the kernel object for execution:
+
+	size_t globalWorkSize[3], localWorkSize[3];
+	AddWorkSize( name, m, n, globalWorkSize, localWorkSize );
+
+	return RunKernel( kernel, name, globalWorkSize, localWorkSize, after );
+}
+
+
+// set the arguments of one of the MatrixAdd... kernels:
+
+void SetAddArgs( cl_kernel kernel, int m, int n, cl_mem dA, int lda, cl_mem dB, int ldb, cl_mem dC, int ldc )
+{
+	SetKernelArg( kernel, 0, sizeof(int),    &m,   "m" );
+	SetKernelArg( kernel, 1, sizeof(int),    &n,   "n" );
+	SetKernelArg( kernel, 2, sizeof(cl_mem), &dA,  "dA" );
+	SetKernelArg( kernel, 3, sizeof(int),    &lda, "lda" );
+	SetKernelArg( kernel, 4, sizeof(cl_mem), &dB,  "dB" );
+	SetKernelArg( kernel, 5, sizeof(int),    &ldb, "ldb" );
+	SetKernelArg( kernel, 6, sizeof(cl_mem), &dC,  "dC" );
+	SetKernelArg( kernel, 7, sizeof(int),    &ldc, "ldc" );
+}
+
+
+// the global and local work sizes that one of the MatrixAdd... kernels needs to cover an m x n dC:
+
+void AddWorkSize( const char *name, int m, int n, size_t *globalWorkSize, size_t *localWorkSize )
+{
+	int localCols = ( LocalCols > 0 ) ? LocalCols : LocalSize;
+	globalWorkSize[0] = RoundUp( m, LocalSize );
+	globalWorkSize[1] = RoundUp( n, localCols );
+	globalWorkSize[2] = 1;
+	localWorkSize[0] = LocalSize;
+	localWorkSize[1] = localCols;
+	localWorkSize[2] = 1;
+
+	if( strcmp( name, "MatrixAddVec" ) == 0 )				// one work-item per vector (plus the tail)
+	{
+		globalWorkSize[1] = RoundUp( (n+VecWidth-1)/VecWidth, localCols );
+	}
+}
+
+
+// multi-device mode: find every OpenCL device on every platform and give each one its own context,
+// profiling queue and build of the kernel sources (devices whose build fails are left out):
+
+void SetupWorkers( const char **sources, int count, const char *options )
+{
+	cl_uint numPlatforms = 0;
+	clGetPlatformIDs( 0, NULL, &numPlatforms );
+	std::vector<cl_platform_id> platforms( numPlatforms );
+	if( numPlatforms > 0 )
+		clGetPlatformIDs( numPlatforms, &platforms[0], NULL );
+
+	Workers.clear( );
+	for( int p = 0; p < (int)numPlatforms; p++ )
+	{
+		cl_uint numDevices = 0;
+		if( clGetDeviceIDs( platforms[p], CL_DEVICE_TYPE_ALL, 0, NULL, &numDevices ) != CL_SUCCESS || numDevices == 0 )
+			continue;
+		std::vector<cl_device_id> devices( numDevices );
+		clGetDeviceIDs( platforms[p], CL_DEVICE_TYPE_ALL, numDevices, &devices[0], NULL );
+
+		for( int d = 0; d < (int)numDevices; d++ )
+		{
+			DeviceWorker w;
+			w.Device = devices[d];
+			w.Name[0] = '\0';
+			clGetDeviceInfo( w.Device, CL_DEVICE_NAME, sizeof(w.Name), w.Name, NULL );
+			w.Context = ocl::Context( w.Device );
+			if( w.Context.Ok( ) )
+			{
+				w.Queue = ocl::Queue( w.Context, w.Device, CL_QUEUE_PROFILING_ENABLE );
+				NameQueue( w.Queue, "Multi-device commands" );
+			}
+			if( w.Queue.Ok( ) )
+				w.Program = ocl::Program( BuildProgram( w.Context, w.Device, sources, count, options ) );
+			if( ! w.Program.Ok( ) )
+			{
+				fprintf( stderr, "Leaving device '%s' out of the multi-device runs\n", w.Name );
+				continue;
+			}
+
+			for( int e = 0; e < NUM_SHARE_EVENTS; e++ )
+				w.Events[e] = NULL;
+			w.MaxAlloc = w.GlobalMem = 0;
+			clGetDeviceInfo( w.Device, CL_DEVICE_MAX_MEM_ALLOC_SIZE, sizeof(w.MaxAlloc),  &w.MaxAlloc,  NULL );
+			clGetDeviceInfo( w.Device, CL_DEVICE_GLOBAL_MEM_SIZE,    sizeof(w.GlobalMem), &w.GlobalMem, NULL );
+			w.Fits = false;
+			w.Rate = 0.;
+			w.Row0 = w.Rows = 0;
+			Workers.push_back( std::move( w ) );
+		}
+	}
+
+	if( Format == FORMAT_TEXT )
+		fprintf( stderr, "Running the multi-device jobs on %d devices\n", (int)Workers.size( ) );
+}
+
+
+// the named kernel on a device -- made the first time it's asked for, and kept in its Kernels after that
+// (so a kernel that can't be made is only complained about once, and comes back NULL):
+
+cl_kernel ShareKernel( DeviceWorker &w, const char *name )
+{
+	std::map<std::string, ocl::Kernel>::iterator it = w.Kernels.find( name );
+	if( it == w.Kernels.end( ) )
+		it = w.Kernels.insert( std::make_pair( std::string( name ), ocl::Kernel( w.Program, name ) ) ).first;
+	return it->second;
+}
+
+
+// can a device take part in a job (see EnqueueShare( ) for what the job is)? -- its kernel has to be made,
+// it has to be able to run the work-groups the current settings give the kernel, and a, b and c have to fit
+// in its memory even if it were given all m rows, so whatever share it ends up with does too
+// (says why not on stderr if it can't):
+
+bool ShareFits( DeviceWorker &w, const char *name, int m, int n, int k, Matrix &a, Matrix &b, Matrix &c )
+{
+	cl_kernel kernel = ShareKernel( w, name );
+	if( kernel == NULL )
+	{
+		fprintf( stderr, "%s can't be made on '%s'\n", name, w.Name );
+		return false;
+	}
+
+	bool add = strncmp( name, "MatrixAdd", 9 ) == 0;
+	size_t globalWorkSize[3], localWorkSize[3];
+	if( add )
+		AddWorkSize( name, m, n, globalWorkSize, localWorkSize );
+	else
+		GemmWorkSize( name, m, n, globalWorkSize, localWorkSize );
+	if( ! WorkGroupFits( kernel, w.Device, name, localWorkSize ) )
+		return false;
+
+	size_t aBytes = (size_t)m * a.Ld * sizeof(float);
+	size_t bBytes = (size_t)( add ? m : k ) * b.Ld * sizeof(float);
+	size_t cBytes = (size_t)m * c.Ld * sizeof(float);
+	if( aBytes > w.MaxAlloc || bBytes > w.MaxAlloc || cBytes > w.MaxAlloc || aBytes + bBytes + cBytes > w.GlobalMem )
+	{
+		fprintf( stderr, "%s: the matrices don't fit on '%s'\n", name, w.Name );
+		return false;
+	}
+	return true;
+}
+
+
+// can kernel run work-groups of localWorkSize[0] x localWorkSize[1] on device? -- they have to be within its
+// CL_KERNEL_WORK_GROUP_SIZE and the device's work-item sizes, and the local memory it uses has to fit
+// (says why not on stderr if it can't):
+
+bool WorkGroupFits( cl_kernel kernel, cl_device_id device, const char *name, const size_t *localWorkSize )
+{
+	size_t groupSize = 0, maxItems[3] = { 0, 0, 0 };
+	cl_ulong kernelLocal = 0, localMem = 0;
+	clGetKernelWorkGroupInfo( kernel, device, CL_KERNEL_WORK_GROUP_SIZE, sizeof(groupSize),   &groupSize,   NULL );
+	clGetKernelWorkGroupInfo( kernel, device, CL_KERNEL_LOCAL_MEM_SIZE,  sizeof(kernelLocal), &kernelLocal, NULL );
+	clGetDeviceInfo( device, CL_DEVICE_MAX_WORK_ITEM_SIZES, sizeof(maxItems), maxItems,  NULL );
+	clGetDeviceInfo( device, CL_DEVICE_LOCAL_MEM_SIZE,      sizeof(localMem), &localMem, NULL );
+
+	if( localWorkSize[0] * localWorkSize[1] > groupSize || localWorkSize[0] > maxItems[0] || localWorkSize[1] > maxItems[1] )
+	{
+		fprintf( stderr, "%s: %d x %d work-groups are too big -- the device can only run %d work-items in one\n",
+			name, (int)localWorkSize[0], (int)localWorkSize[1], (int)groupSize );
+		return false;
+	}
+	if( kernelLocal > localMem )
+	{
+		fprintf( stderr, "%s: it needs %llu bytes of local memory, and the device only has %llu\n",
+			name, (unsigned long long)kernelLocal, (unsigned long long)localMem );
+		return false;
+	}
+	return true;
+}
+
+
+// get a device ready to take rows rows of a job (see EnqueueShare( ) for what the job is) -- make its kernel,
+// and grow its buffers if they are too small -- so enqueueing the share doesn't have to
+// returns the kernel (NULL if it couldn't be made):
+
+cl_kernel PrepareShare( DeviceWorker &w, const char *name, int rows, int k, Matrix &a, Matrix &b, Matrix &c )
+{
+	cl_kernel kernel = ShareKernel( w, name );
+
+	bool add = strncmp( name, "MatrixAdd", 9 ) == 0;
+	size_t aCount = (size_t)rows * a.Ld;
+	size_t bCount = (size_t)( add ? rows : k ) * b.Ld;
+	size_t cCount = (size_t)rows * c.Ld;
+
+	// (the old buffer goes first, so the two are never both allocated)
+
+	if( w.dA.Size( ) < aCount )
+	{
+		w.dA.Reset( );
+		w.dA = ocl::Buffer<float>( w.Context, CL_MEM_READ_ONLY,  aCount, NULL, "a share of dA" );
+	}
+	if( w.dB.Size( ) < bCount )
+	{
+		w.dB.Reset( );
+		w.dB = ocl::Buffer<float>( w.Context, CL_MEM_READ_ONLY,  bCount, NULL, "a share of dB" );
+	}
+	if( w.dC.Size( ) < cCount )
+	{
+		w.dC.Reset( );
+		w.dC = ocl::Buffer<float>( w.Context, CL_MEM_READ_WRITE, cCount, NULL, "a share of dC" );
+	}
+
+	return kernel;
+}
+
+
+// enqueue one device's share of a job -- rows row0 ... row0+rows-1 of c = alpha * a * b + beta * c for
+// the MatrixMult... kernels, or of c = a + b for the MatrixAdd... kernels (k is ignored) -- without waiting for it:
+// the rows of a and c (and all of b, or the same rows of b for an addition) are copied to the device,
+// and the rows of c are copied back afterwards if readBack is set
+// the commands go on the device's own in-order queue, so they run one after another, and FinishShare( ) waits for them:
+
+void EnqueueShare( DeviceWorker &w, const char *name, int row0, int rows, int n, int k, float alpha, Matrix &a, Matrix &b, float beta, Matrix &c, bool readBack )
+{
+	for( int e = 0; e < NUM_SHARE_EVENTS; e++ )
+		w.Events[e] = NULL;
+	if( rows <= 0 )
+		return;
+
+	cl_int status;
+	bool add = strncmp( name, "MatrixAdd", 9 ) == 0;
+	int bRows = add ? rows : k;
+	size_t aBytes = (size_t)rows  * a.Ld * sizeof(float);
+	size_t bBytes = (size_t)bRows * b.Ld * sizeof(float);
+	size_t cBytes = (size_t)rows  * c.Ld * sizeof(float);
+
+	cl_kernel kernel = PrepareShare( w, name, rows, k, a, b, c );
+
+	status = clEnqueueWriteBuffer( w.Queue, w.dA, CL_FALSE, 0, aBytes, a[row0], 0, NULL, &w.Events[SHARE_WRITE_A] );
+	if( status != CL_SUCCESS )
+		fprintf( stderr, "clEnqueueWriteBuffer failed for a share of matrix A (%d)\n", status );
+
+	status = clEnqueueWriteBuffer( w.Queue, w.dB, CL_FALSE, 0, bBytes, add ? b[row0] : b.Data, 0, NULL, &w.Events[SHARE_WRITE_B] );
+	if( status != CL_SUCCESS )
+		fprintf( stderr, "clEnqueueWriteBuffer failed for a share of matrix B (%d)\n", status );
+
+	if( ! add && beta != 0.f )
+	{
+		status = clEnqueueWriteBuffer( w.Queue, w.dC, CL_FALSE, 0, cBytes, c[row0], 0, NULL, &w.Events[SHARE_WRITE_C] );
+		if( status != CL_SUCCESS )
+			fprintf( stderr, "clEnqueueWriteBuffer failed for a share of matrix C (%d)\n", status );
+	}
+
+	size_t globalWorkSize[3], localWorkSize[3];
+	if( add )
+	{
+		SetAddArgs( kernel, rows, n, w.dA, a.Ld, w.dB, b.Ld, w.dC, c.Ld );
+		AddWorkSize( name, rows, n, globalWorkSize, localWorkSize );
+	}
+	else
+	{
+		SetGemmArgs( kernel, rows, n, k, alpha, w.dA, a.Ld, w.dB, b.Ld, beta, w.dC, c.Ld );
+		GemmWorkSize( name, rows, n, globalWorkSize, localWorkSize );
+	}
+
+	status = clEnqueueNDRangeKernel( w.Queue, kernel, 2, NULL, globalWorkSize, localWorkSize, 0, NULL, &w.Events[SHARE_RUN] );
+	if( status != CL_SUCCESS )
+		fprintf( stderr, "clEnqueueNDRangeKernel failed on '%s': %d\n", w.Name, status );
+
+	if( readBack )
+	{
+		status = clEnqueueReadBuffer( w.Queue, w.dC, CL_FALSE, 0, cBytes, c[row0], 0, NULL, &w.Events[SHARE_READ_C] );
+		if( status != CL_SUCCESS )
+			fprintf( stderr, "clEnqueueReadBuffer failed for a share of matrix C (%d)\n", status );
+	}
+
+	clFlush( w.Queue );
+}
+
+
+// wait for a device's share to finish, and record its commands under name (or just drop them if name is NULL)
+// (its kernel and buffers are kept for the next share):
+
+void FinishShare( DeviceWorker &w, const char *name )
+{
+	clFinish( w.Queue );
+
+	if( name != NULL )
+	{
+		RecordEvent( w.Events[SHARE_WRITE_A], STAGE_H2D,    "Write dA share" );
+		RecordEvent( w.Events[SHARE_WRITE_B], STAGE_H2D,    "Write dB share" );
+		RecordEvent( w.Events[SHARE_WRITE_C], STAGE_H2D,    "Write dC share" );
+		RecordEvent( w.Events[SHARE_RUN],     STAGE_KERNEL, name );
+		RecordEvent( w.Events[SHARE_READ_C],  STAGE_D2H,    "Read dC share" );
+	}
+	else
+	{
+		for( int e = 0; e < NUM_SHARE_EVENTS; e++ )
+		{
+			if( w.Events[e] != NULL )
+				clReleaseEvent( w.Events[e] );
+		}
+	}
+	for( int e = 0; e < NUM_SHARE_EVENTS; e++ )
+		w.Events[e] = NULL;
+}
+
+
+// measure how many rows per second each device gets through on this job, by timing its kernel on
+// the first PROBE_ROWS rows (twice -- the first run on a device pays for getting it going),
+// then hand out the m rows in proportion (a device that can't run the job at all gets none -- see ShareFits( ))
+// this is done once for each job, before it is run (by MultiDeviceRun( )) as many times as needed:
+
+#define PROBE_ROWS	64
+
+void SplitRows( const char *name, int m, int n, int k, float alpha, Matrix &a, Matrix &b, float beta, Matrix &c )
+{
+	UseConfig( NULL, 0 );		// (the same settings MultiDeviceRun( ) uses)
+
+	int probeRows = ( m < PROBE_ROWS ) ? m : PROBE_ROWS;
+	double total = 0.;
+	int fit = 0, last = -1;
+
+	for( size_t i = 0; i < Workers.size( ); i++ )
+	{
+		DeviceWorker &w = Workers[i];
+		w.Rate = 0.;
+		w.Fits = ShareFits( w, name, m, n, k, a, b, c );
+		if( ! w.Fits )
+		{
+			fprintf( stderr, "Leaving device '%s' out of the multi-device %s\n", w.Name, name );
+			continue;
+		}
+		fit++;
+		last = (int)i;
+
+		for( int trial = 0; trial < 2; trial++ )
+		{
+			EnqueueShare( w, name, 0, probeRows, n, k, alpha, a, b, beta, c, false );
+			clFinish( w.Queue );
+			if( w.Events[SHARE_RUN] != NULL )
+			{
+				cl_ulong start = EventTime( w.Events[SHARE_RUN], CL_PROFILING_COMMAND_START );
+				cl_ulong end   = EventTime( w.Events[SHARE_RUN], CL_PROFILING_COMMAND_END );
+				w.Rate = ( end > start ) ? (double)probeRows / ( (double)( end - start ) / 1000000000. ) : 0.;
+			}
+			FinishShare( w, NULL );
+		}
+		total += w.Rate;
+	}
+
+	// (if nothing could be timed, the rows are split evenly between the devices that can run the job)
+
+	if( fit == 0 )
+		fprintf( stderr, "None of the devices can run the multi-device %s\n", name );
+
+	double sum = 0.;
+	int row0 = 0;
+	for( size_t i = 0; i < Workers.size( ); i++ )
+	{
+		DeviceWorker &w = Workers[i];
+		if( w.Fits )
+			sum += ( total > 0. ) ? w.Rate : 1.;
+		int row1 = ( ! w.Fits ) ? row0 : ( (int)i == last ) ? m : (int)( (double)m * sum / ( total > 0. ? total : (double)fit ) + 0.5 );
+		w.Row0 = row0;
+		w.Rows = row1 - row0;
+		row0 = row1;
+		if( Format == FORMAT_TEXT && ! Quiet )
+			fprintf( stderr, "%s on '%s': %12.0lf rows/s in the probe, gets rows %6d - %6d\n", name, w.Name, w.Rate, w.Row0, w.Row0 + w.Rows - 1 );
+	}
+}
+
+
+// run a job on every device at once, each on its own share of the rows of c, and gather the results into c
+// (see EnqueueShare( ) for what the job is) -- SplitRows( ) has to have shared the rows out for this job first
+// returns the wall-clock time from the first share being enqueued to the last one finishing, in seconds
+// -- the devices' own clocks can't be compared with each other:
+
+double MultiDeviceRun( const char *name, int m, int n, int k, float alpha, Matrix &a, Matrix &b, float beta, Matrix &c )
+{
+	if( Workers.empty( ) )
+		return 0.;
+
+	// (a split that was made for a different job doesn't cover these rows)
+
+	int rows = 0;
+	for( size_t i = 0; i < Workers.size( ); i++ )
+		rows += Workers[i].Rows;
+	if( rows != m )
+	{
+		fprintf( stderr, "%s: the devices were given %d rows, not %d -- call SplitRows( ) for this job first\n", name, rows, m );
+		return 0.;
+	}
+
+	UseConfig( NULL, 0 );		// (the other devices were built with the default settings, and weren't tuned)
+	for( size_t i = 0; i < Workers.size( ); i++ )
+		PrepareShare( Workers[i], name, Workers[i].Rows, k, a, b, c );		// (so the time is only the transfers and the kernels)
+
+	double time0 = omp_get_wtime( );
+	for( size_t i = 0; i < Workers.size( ); i++ )
+		EnqueueShare( Workers[i], name, Workers[i].Row0, Workers[i].Rows, n, k, alpha, a, b, beta, c, true );
+	for( size_t i = 0; i < Workers.size( ); i++ )
+		clFinish( Workers[i].Queue );
+	double time1 = omp_get_wtime( );
+
+	for( size_t i = 0; i < Workers.size( ); i++ )
+		FinishShare( Workers[i], name );
+
+	return time1 - time0;
+}
+
+
+// enqueue a 2D kernel whose arguments are already set, to run after the commands in after
+// (it doesn't wait for it to finish -- Get( ) the result for the kernel execution time, as measured by the device):
+
+Pending RunKernel( cl_kernel kernel, const char *name, size_t *globalWorkSize, size_t *localWorkSize, const std::vector<cl_event> &after )
+{
+	if( Format == FORMAT_TEXT && ! Quiet )
+	{
+		fprintf( stderr, "%s\n", name );
+		fprintf( stderr, "Number of Work Groups = %5d x %5d\n", (int)(globalWorkSize[0]/localWorkSize[0]), (int)(globalWorkSize[1]/localWorkSize[1]) );
+	}
+
+	cl_event run = NULL;
+	cl_int status = clEnqueueNDRangeKernel( CmdQueue, kernel, 2, NULL, globalWorkSize, localWorkSize,
+		(cl_uint)after.size( ), after.empty( ) ? NULL : &after[0], &run );
+	if( status != CL_SUCCESS )
+		fprintf( stderr, "clEnqueueNDRangeKernel failed: %d\n", status );
+
+	return Pending( run, STAGE_KERNEL, name );
+}
+
+
+// set one kernel argument and complain if it didn't take:
+
+void SetKernelArg( cl_kernel kernel, int index, size_t size, const void *value, const char *name )
+{
+	cl_int status = clSetKernelArg( kernel, index, size, value );
+	if ( status != CL_SUCCESS )
+		fprintf( stderr, "clSetKernelArg failed for %s (%d)\n", name, status );
+}
+
+
+// 12. read the results buffer back from the device to hC, and wait for it:
+// (it's the only place the host waits for CmdQueue, and everything enqueued before it is done by then,
+// so the Unsettled commands are recorded here too)
+// (in zero-copy mode, map it instead -- dC is built on hC, so the map hands back hC itself
+// and hC stays valid until ReleaseResults( ) unmaps it before dC is used again)
+
+void ReadResults( cl_mem dC )
+{
+	cl_int status;
+
+	if( ZeroCopy )
+	{
+		cl_event map = NULL;
+		void *p = clEnqueueMapBuffer( CmdQueue, dC, CL_TRUE, CL_MAP_READ, 0, hC.Bytes, 0, NULL, &map, &status );
+		if( status != CL_SUCCESS )
+			fprintf( stderr, "clEnqueueMapBuffer failed\n" );
+		else if( p != hC.Data )
+			fprintf( stderr, "clEnqueueMapBuffer did not map dC onto hC\n" );
+
+		RecordEvent( map, STAGE_D2H, "Map dC" );
+		Settle( );
+		return;
+	}
+
+	cl_event read = NULL;
+	status = clEnqueueReadBuffer( CmdQueue, dC, CL_FALSE, 0, hC.Bytes, hC.Data, 0, NULL, &read );
+	if( status != CL_SUCCESS )
+			fprintf( stderr, "clEnqueueReadBuffer failed\n" );
+
+	RecordEvent( read, STAGE_D2H, "Read dC" );		// (this is where the host waits -- it needs hC now)
+	Settle( );
+}
+
+
+// hand dC back to the device after the host is done looking at hC
+// (the commands after it on CmdQueue follow it anyway, so the host doesn't wait for it here -- but the host
+// mustn't write or free hC until it's done, so anything that does calls Settle( ) first):
+
+void ReleaseResults( cl_mem dC )
+{
+	if( ! ZeroCopy )
+		return;
+
+	cl_event unmap = NULL;
+	cl_int status = clEnqueueUnmapMemObject( CmdQueue, dC, hC.Data, 0, NULL, &unmap );
+	if( status != CL_SUCCESS )
+		fprintf( stderr, "clEnqueueUnmapMemObject failed\n" );
+
+	Unsettled.push_back( Pending( unmap, STAGE_H2D, "Unmap dC" ) );
+}
+
+
+// one of the profiling timestamps of a finished command, in nanoseconds:
+
+cl_ulong EventTime( cl_event event, cl_profiling_info which )
+{
+	cl_ulong time = 0;
+	if( event != NULL )
+	{
+		clWaitForEvents( 1, &event );
+		clGetEventProfilingInfo( event, which, sizeof(time), &time, NULL );
+	}
+	return time;
+}
+
+
+// save the profiling timestamps of a finished command and release its event
+// returns how long the command ran on the device, in seconds:
+
+double RecordEvent( cl_event event, StageType stage, const char *name )
+{
+	if( event == NULL )			// the enqueue failed -- there is nothing to record
+		return 0.;
+
+	CommandTiming t;
+	t.Name = name;
+	t.Stage = stage;
+	t.Device = NULL;
+	cl_command_queue queue = NULL;
+	if( clGetEventInfo( event, CL_EVENT_COMMAND_QUEUE, sizeof(queue), &queue, NULL ) == CL_SUCCESS && queue != NULL )
+		clGetCommandQueueInfo( queue, CL_QUEUE_DEVICE, sizeof(t.Device), &t.Device, NULL );
+
+	cl_int status = clWaitForEvents( 1, &event );
+	status |= clGetEventProfilingInfo( event, CL_PROFILING_COMMAND_QUEUED, sizeof(cl_ulong), &t.Queued, NULL );
+	status |= clGetEventProfilingInfo( event, CL_PROFILING_COMMAND_SUBMIT, sizeof(cl_ulong), &t.Submit, NULL );
+	status |= clGetEventProfilingInfo( event, CL_PROFILING_COMMAND_START,  sizeof(cl_ulong), &t.Start,  NULL );
+	status |= clGetEventProfilingInfo( event, CL_PROFILING_COMMAND_END,    sizeof(cl_ulong), &t.End,    NULL );
+	if( status == CL_SUCCESS )
+		TraceCommand( event, name, StageNames[stage], t.Start, t.End );
+	clReleaseEvent( event );
+
+	if( status != CL_SUCCESS )
+	{
+		fprintf( stderr, "clGetEventProfilingInfo failed for %s\n", name );
+		return 0.;
+	}
+
+	Timings.push_back( t );
+	return (double)( t.End - t.Start ) / 1000000000.;
+}
+
+// wait for the command if it hasn't finished, record it the first time, and return its device time in seconds:
+
+double Pending::Get( )
+{
+	if( Handle != NULL )
+	{
+		Time = RecordEvent( Handle, Stage, Name );
+		Handle = NULL;
+	}
+	return Time;
+}
+
+
+// record the commands in Unsettled:
+
+void Settle( )
+{
+	for( size_t i = 0; i < Unsettled.size( ); i++ )
+		Unsettled[i].Get( );
+	Unsettled.clear( );
+}
+
+
+
+// print where the device time went: each command's queued->submit, submit->start and start->end times,
+// then the start->end totals for each stage and the span from the first queued to the last finished command:
+
+void PrintTimings( )
+{
+	if( Format != FORMAT_TEXT || Timings.empty( ) )
+		return;
+
+	fprintf( stderr, "Device Timings (ms)\n" );
+	fprintf( stderr, "%-24s %-6s %10s %10s %10s\n", "Command", "Stage", "Queued", "Submitted", "Running" );
+
+	// (the span from first queued to last finished only covers the selected device's commands -- the other
+	// devices' clocks, in the multi-device runs, can't be compared with its clock)
+
+	double stageTotals[NUM_STAGES] = { 0., 0., 0. };
+	cl_ulong first = 0, last = 0;
+	bool any = false;
+	for( size_t i = 0; i < Timings.size( ); i++ )
+	{
+		CommandTiming &t = Timings[i];
+		fprintf( stderr, "%-24s %-6s %10.3lf %10.3lf %10.3lf\n", t.Name, StageNames[t.Stage],
+			(double)( t.Submit - t.Queued ) / 1000000., (double)( t.Start - t.Submit ) / 1000000., (double)( t.End - t.Start ) / 1000000. );
+
+		stageTotals[t.Stage] += (double)( t.End - t.Start ) / 1000000.;
+		if( t.Device != Device )
+			continue;
+		if( ! any || t.Queued < first )
+			first = t.Queued;
+		if( ! any || t.End > last )
+			last = t.End;
+		any = true;
+	}
+
+	double total = 0.;
+	for( int s = 0; s < NUM_STAGES; s++ )
+	{
+		fprintf( stderr, "%s = %.3lf ms , ", StageNames[s], stageTotals[s] );
+		total += stageTotals[s];
+	}
+	if( any )
+		fprintf( stderr, "Total = %.3lf ms (%.3lf ms from first queued to last finished on the selected device)\n\n", total, (double)( last - first ) / 1000000. );
+	else
+		fprintf( stderr, "Total = %.3lf ms\n\n", total );
+}
+
+// give a queue a name for its track in the trace (a queue nobody named is just "Queue"):
+
+void NameQueue( cl_command_queue queue, const char *name )
+{
+	QueueNames[queue] = name;
+}
+
+
+// add a finished command to the trace (start and end are its CL_PROFILING_COMMAND_START/END times)
+// -- the device and queue are looked up now, since the queue may be gone by the time the trace is written:
+
+void TraceCommand( cl_event event, const char *name, const char *category, cl_ulong start, cl_ulong end )
+{
+	if( TraceFile == NULL )
+		return;
+
+	TraceEvent t;
+	t.Name = name;
+	t.Category = category;
+	t.Device = NULL;
+	t.Queue = "Queue";
+	t.Start = (long long)start;
+	t.End = (long long)end;
+	t.Recorded = (long long)( ( omp_get_wtime( ) - TraceStart ) * 1000000000. );
+
+	cl_command_queue queue = NULL;
+	clGetEventInfo( event, CL_EVENT_COMMAND_QUEUE, sizeof(queue), &queue, NULL );
+	if( queue != NULL )
+	{
+		clGetCommandQueueInfo( queue, CL_QUEUE_DEVICE, sizeof(t.Device), &t.Device, NULL );
+		std::map<cl_command_queue, std::string>::iterator it = QueueNames.find( queue );
+		if( it != QueueNames.end( ) )
+			t.Queue = it->second;
+	}
+	Trace.push_back( t );
+}
+
+
+// add a span of host work that started at start (an omp_get_wtime( ) time) and is just finishing to the trace:
+
+void TraceHost( const char *name, double start )
+{
+	if( TraceFile == NULL )
+		return;
+
+	TraceEvent t;
+	t.Name = name;
+	t.Category = "Host";
+	t.Device = NULL;
+	t.Queue = "Host";
+	t.Start = (long long)( ( start - TraceStart ) * 1000000000. );
+	t.End = (long long)( ( omp_get_wtime( ) - TraceStart ) * 1000000000. );
+	t.Recorded = t.End;
+	Trace.push_back( t );
+}
+
+
+// write the trace as Chrome trace JSON: the host is one process with one track, and each device is a
+// process with a track for each of its queues
+// each device's timestamps are moved onto the host's clock by the smallest gap between a command ending on
+// the device and the host recording it -- the host only records a command after waiting for it, so that
+// gap is never less than the true offset, and the smallest one is the closest to it:
+
+void WriteTrace( const char *fileName )
+{
+	if( fileName == NULL )
+		return;
+
+	FILE *fp = fopen( fileName, "w" );
+	if( fp == NULL )
+	{
+		fprintf( stderr, "Cannot write the trace to '%s'\n", fileName );
+		return;
+	}
+
+	std::vector<cl_device_id> devices;						// process i+1 is devices[i]
+	std::map<cl_device_id, long long> offsets;
+	std::vector< std::pair<int, std::string> > tracks;		// (process, queue name) -- track i has thread id i
+	for( size_t i = 0; i < Trace.size( ); i++ )
+	{
+		TraceEvent &t = Trace[i];
+		if( t.Device != NULL )
+		{
+			if( offsets.find( t.Device ) == offsets.end( ) )
+			{
+				devices.push_back( t.Device );
+				offsets[t.Device] = t.Recorded - t.End;
+			}
+			else if( t.Recorded - t.End < offsets[t.Device] )
+				offsets[t.Device] = t.Recorded - t.End;
+		}
+	}
+
+	fprintf( fp, "{ \"displayTimeUnit\": \"ms\", \"traceEvents\": [\n" );
+	fprintf( fp, "  { \"name\": \"process_name\", \"ph\": \"M\", \"pid\": 0, \"args\": { \"name\": \"Host\" } }" );
+	for( size_t d = 0; d < devices.size( ); d++ )
+	{
+		char name[256] = "";
+		clGetDeviceInfo( devices[d], CL_DEVICE_NAME, sizeof(name), name, NULL );
+		fprintf( fp, ",\n  { \"name\": \"process_name\", \"ph\": \"M\", \"pid\": %d, \"args\": { \"name\": \"%s\" } }",
+			(int)d + 1, JsonSafe( name ).c_str( ) );
+	}
+
+	for( size_t i = 0; i < Trace.size( ); i++ )
+	{
+		TraceEvent &t = Trace[i];
+		int pid = 0;
+		long long offset = 0;
+		if( t.Device != NULL )
+		{
+			pid = (int)( std::find( devices.begin( ), devices.end( ), t.Device ) - devices.begin( ) ) + 1;
+			offset = offsets[t.Device];
+		}
+
+		std::pair<int, std::string> track( pid, t.Queue );
+		int tid = (int)( std::find( tracks.begin( ), tracks.end( ), track ) - tracks.begin( ) );
+		if( tid == (int)tracks.size( ) )
+		{
+			tracks.push_back( track );
+			fprintf( fp, ",\n  { \"name\": \"thread_name\", \"ph\": \"M\", \"pid\": %d, \"tid\": %d, \"args\": { \"name\": \"%s\" } }",
+				pid, tid, JsonSafe( t.Queue.c_str( ) ).c_str( ) );
+		}
+
+		fprintf( fp, ",\n  { \"name\": \"%s\", \"cat\": \"%s\", \"ph\": \"X\", \"pid\": %d, \"tid\": %d, \"ts\": %.3lf, \"dur\": %.3lf }",
+			JsonSafe( t.Name.c_str( ) ).c_str( ), t.Category, pid, tid,
+			(double)( t.Start + offset ) / 1000., (double)( t.End - t.Start ) / 1000. );
+	}
+	fprintf( fp, "\n] }\n" );
+	fclose( fp );
+
+	if( Format == FORMAT_TEXT )
+		fprintf( stderr, "Wrote %d trace events to '%s'\n", (int)Trace.size( ), fileName );
+}
+
+
+// s with the characters that can't go in a JSON string as they are escaped:
+
+std::string JsonSafe( const char *s )
+{
+	std::string safe;
+	for( ; *s != '\0'; s++ )
+	{
+		if( *s == '"' || *s == '\\' )
+		{
+			safe += '\\';
+			safe += *s;
+		}
+		else if( (unsigned char)*s >= ' ' )
+			safe += *s;
+	}
+	return safe;
+}
+
+
+
+// print the performance of one m x n x k kernel run along with the last element of hC
+// (name identifies the run in the CSV and JSON output and says which kernel it was -- see KernelFlops( ) --
+// and title is what people see)
+// the rates are for the median run (and the best one), and if roofline is set they are also put under the
+// device's roofline -- it isn't for the runs that include transfers or don't run on the one device:
+
+void PrintResults( const char *name, const char *title, int localSize, int m, int n, int k, const BenchStats &stats, bool roofline )
+{
+	double flops = KernelFlops( name, m, n, k );
+	double bytes = KernelBytes( name, m, n, k );
+	double gflops = flops / stats.Median / 1000000000.;
+	double best = flops / stats.Min / 1000000000.;
+	double gbps = bytes / stats.Median / 1000000000.;
+	double intensity = flops / bytes;
+	bool memoryBound = false;
+	double percent = roofline ? RooflinePercent( gflops, intensity, &memoryBound ) : 0.;
+	const char *bound = ( percent <= 0. ) ? "" : memoryBound ? "memory" : "compute";
+
+	if( Format == FORMAT_TEXT )
+	{
+		fprintf( stderr, "%s Results\n", title );
+		fprintf( stderr, "Matrix Size: %6d x %6d , Work Elements: %4d x %4d , dC[%6d][%6d] = %12.2f\n",
+			m, n, localSize, localSize, m-1, n-1, hC[m-1][n-1] );
+		fprintf( stderr, "GFLOP/s: %10.2lf (best %10.2lf) , GB/s: %8.2lf , FLOP/byte: %6.2lf", gflops, best, gbps, intensity );
+		if( percent > 0. )
+			fprintf( stderr, " , %5.1lf%% of the roofline (%s-bound)", percent, bound );
+		fprintf( stderr, "\n" );
+		fprintf( stderr, "Time (ms) over %d runs: min = %10.3lf , median = %10.3lf , p95 = %10.3lf , stddev = %10.3lf\n",
+			stats.Reps, stats.Min*1000., stats.Median*1000., stats.P95*1000., stats.StdDev*1000. );
+		fprintf( stderr, "\n" );
+	}
+	else if( Format == FORMAT_CSV )
+	{
+		static bool header = false;
+		if( ! header )
+		{
+			fprintf( stdout, "name,m,n,k,local,reps,min_ms,median_ms,p95_ms,mean_ms,stddev_ms,gflops,best_gflops,gbps,flop_per_byte,roofline_pct,bound\n" );
+			header = true;
+		}
+		fprintf( stdout, "\"%s\",%d,%d,%d,%d,%d,%.6lf,%.6lf,%.6lf,%.6lf,%.6lf,%.4lf,%.4lf,%.4lf,%.4lf,%.2lf,%s\n",
+			name, m, n, k, localSize, stats.Reps, stats.Min*1000., stats.Median*1000., stats.P95*1000., stats.Mean*1000., stats.StdDev*1000.,
+			gflops, best, gbps, intensity, percent, bound );
+		fflush( stdout );
+	}
+	else
+	{
+		char object[1024];
+		snprintf( object, sizeof(object),
+			"{ \"name\": \"%s\", \"m\": %d, \"n\": %d, \"k\": %d, \"local\": %d, \"reps\": %d, "
+			"\"min_ms\": %.6lf, \"median_ms\": %.6lf, \"p95_ms\": %.6lf, \"mean_ms\": %.6lf, \"stddev_ms\": %.6lf, "
+			"\"gflops\": %.4lf, \"best_gflops\": %.4lf, \"gbps\": %.4lf, \"flop_per_byte\": %.4lf, \"roofline_pct\": %.2lf, \"bound\": \"%s\" }",
+			name, m, n, k, localSize, stats.Reps, stats.Min*1000., stats.Median*1000., stats.P95*1000., stats.Mean*1000., stats.StdDev*1000.,
+			gflops, best, gbps, intensity, percent, bound );
+		Report.push_back( object );
+	}
+}
+
+
+// how close gflops, at intensity FLOP/byte, comes to the device's roofline, in percent: the most the device can
+// do at that intensity is the smaller of its peak flop rate and intensity x its peak bandwidth (DeviceGflops and
+// DeviceGbps, as measured by the probe kernels) -- *memoryBound says whether it's the bandwidth
+// returns 0 if there are no probe results:
+
+double RooflinePercent( double gflops, double intensity, bool *memoryBound )
+{
+	*memoryBound = false;
+	if( DeviceGflops <= 0. || DeviceGbps <= 0. )
+		return 0.;
+
+	double ceiling = intensity * DeviceGbps;
+	*memoryBound = ceiling < DeviceGflops;
+	if( ! *memoryBound )
+		ceiling = DeviceGflops;
+	return 100. * gflops / ceiling;
+}
+
+
+// print the JSON results collected by PrintResults( ) as one array (nothing to do for the other formats):
+
+void PrintReport( )
+{
+	if( Format != FORMAT_JSON )
+		return;
+
+	fprintf( stdout, "[\n" );
+	for( size_t i = 0; i < Report.size( ); i++ )
+		fprintf( stdout, "  %s%s\n", Report[i].c_str( ), i+1 < Report.size( ) ? "," : "" );
+	fprintf( stdout, "]\n" );
+	fflush( stdout );
+}
+
+
+// run job Warmup times without looking at the times, then Reps times for real, and summarize the timed runs
+// job returns either the time it took in seconds, or a Pending command whose Get( ) is the time -- every run is
+// enqueued before the first one is waited for, so the device goes straight from one to the next
+// (only the last run's commands are kept in Timings, and only the first run reports itself):
+
+template <typename Job>
+BenchStats Benchmark( Job job )
+{
+	int runs = Warmup + Reps;
+	bool quiet = Quiet;
+
+	std::vector< decltype( job( ) ) > results;
+	results.reserve( runs );
+	for( int r = 0; r < runs; r++ )
+	{
+		size_t timings = Timings.size( );
+		results.push_back( job( ) );
+		if( r+1 < runs )
+			Timings.resize( timings );
+		Quiet = true;
+	}
+	Quiet = quiet;
+
+	std::vector<double> times;
+	for( int r = 0; r < runs; r++ )
+	{
+		size_t timings = Timings.size( );
+		double time = Seconds( results[r] );
+		if( r+1 < runs )
+			Timings.resize( timings );
+		if( r >= Warmup )
+			times.push_back( time );
+	}
+	return Summarize( times );
+}
+
+
+// the min, median, 95th percentile (nearest rank), mean and standard deviation of some times
+// (times is sorted along the way):
+
+BenchStats Summarize( std::vector<double> &times )
+{
+	BenchStats stats;
+	stats.Reps = (int)times.size( );
+	stats.Min = stats.Median = stats.P95 = stats.Mean = stats.StdDev = 0.;
+	if( times.empty( ) )
+		return stats;
+
+	std::sort( times.begin( ), times.end( ) );
+	size_t count = times.size( );
+	stats.Min = times[0];
+	stats.Median = ( count % 2 == 1 ) ? times[count/2] : 0.5 * ( times[count/2 - 1] + times[count/2] );
+	stats.P95 = times[ (size_t)ceil( 0.95 * (double)count ) - 1 ];
+
+	for( size_t i = 0; i < count; i++ )
+		stats.Mean += times[i];
+	stats.Mean /= (double)count;
+
+	if( count > 1 )
+	{
+		double sum = 0.;
+		for( size_t i = 0; i < count; i++ )
+			sum += ( times[i] - stats.Mean ) * ( times[i] - stats.Mean );
+		stats.StdDev = sqrt( sum / (double)( count - 1 ) );
+	}
+	return stats;
+}
+
+
+// allocate a rows x cols matrix whose rows each start on a MATRIX_ALIGNMENT boundary,
+// with the whole block starting on an alignment boundary:
+
+bool Matrix::Allocate( int rows, int cols, size_t alignment )
+{
+	Free( );
+
+	int rowAlign = MATRIX_ALIGNMENT / sizeof(float);
+	Ld = (int)RoundUp( cols, rowAlign );
+	Rows = rows;
+	Cols = cols;
+	Bytes = RoundUp( (size_t)rows * Ld * sizeof(float), alignment );
+
+#ifdef WIN32
+	Data = (float *)_aligned_malloc( Bytes, alignment );
+#else
+	if( posix_memalign( (void **)&Data, alignment, Bytes ) != 0 )
+		Data = NULL;
+#endif
+	if( Data == NULL )
+	{
+		Rows = Cols = Ld = 0;
+		Bytes = 0;
+		return false;
+	}
+
+	memset( Data, 0, Bytes );		// so the padding at the end of each row is defined
+	return true;
+}
+
+
+void Matrix::Free( )
+{
+	if( Data != NULL )
+	{
+#ifdef WIN32
+		_aligned_free( Data );
+#else
+		free( Data );
+#endif
+	}
+	Data = NULL;
+}
+
+
+// hand back a copy of one of the kernel source files (delete [ ] it when done):
+// normally this is the text compiled in from kernel_sources.h, but if KernelDir is set the file
+// is read from there instead, so kernel changes can be tried without rebuilding
+// returns NULL if there is no such file:
+
+char * GetKernelSource( const char *fileName )
+{
+	if( KernelDir == NULL )
+	{
+		for( int i = 0; i < NumKernelSources; i++ )
+		{
+			if( strcmp( KernelSources[i].FileName, fileName ) == 0 )
+			{
+				size_t size = strlen( KernelSources[i].Text );
+				char *text = new char[ size+1 ];
+				memcpy( text, KernelSources[i].Text, size+1 );
+				return text;
+			}
+		}
+		return NULL;
+	}
+
+	char path[1024];
+	snprintf( path, sizeof(path), "%s/%s", KernelDir, fileName );
+
+	FILE *fp;
+#ifdef WIN32
+	if( fopen_s( &fp, path, "r" ) != 0 )
+		fp = NULL;
+#else
+	fp = fopen( path, "r" );
+#endif
+	if( fp == NULL )
+		return NULL;
+
+	fseek( fp, 0, SEEK_END );
+	size_t fileSize = ftell( fp );
+	fseek( fp, 0, SEEK_SET );
+	char *text = new char[ fileSize+1 ];		// leave room for '\0'
+	size_t n = fread( text, 1, fileSize, fp );
+	text[n] = '\0';
+	fclose( fp );
+	if( n != fileSize )
+		fprintf( stderr, "Expected to read %d bytes from '%s' -- actually read %d.\n", (int)fileSize, path, (int)n );
+
+	return text;
+}
+
+
+// the options to build the kernel sources with for the current settings: the constants they are specialized for
+// (the tile width, the micro-tile, the vector width and -- if Specialize is on and k isn't 0 -- the length of the
+// dot products), and the relaxed-math options if FastMath is on:
+
+void KernelOptions( char *options, size_t size, int k )
+{
+	int n = snprintf( options, size, "-DTILESIZE=%d -DMICROROWS=%d -DMICROCOLS=%d -DVECWIDTH=%d", TileSize, MicroRows, MicroCols, VecWidth );
+	if( Specialize && k > 0 && n < (int)size )
+		n += snprintf( options + n, size - n, " -DKSIZE=%d", k );
+	if( FastMath && n < (int)size )
+		n += snprintf( options + n, size - n, " -cl-fast-relaxed-math -cl-mad-enable" );
+}
+
+
+// make Program the build of the kernel sources for the current settings, specialized for k
+// (each set of options is only built once -- after that its build is picked up from Programs)
+// if they don't build, Program is NULL, and the kernels made from it fail (once each) instead of running:
+
+void UseProgram( int k )
+{
+	char options[256];
+	KernelOptions( options, sizeof(options), k );
+
+	bool built = Programs.count( options ) > 0;			// (a failed build is kept too, so it isn't tried again)
+	ocl::Program &program = Programs[options];
+	if( ! built )
+	{
+		double start = omp_get_wtime( );
+		program = ocl::Program( BuildProgram( Context, Device, (const char **)ProgramSources, 2, options ) );
+		std::string span = std::string( "Build " ) + options;
+		TraceHost( span.c_str( ), start );
+	}
+	Program = program;
+}
+
+
+// the named kernel from Program -- made the first time it's asked for, and kept in Kernels after that
+// (so a kernel that can't be made is only complained about once, and comes back NULL):
+
+cl_kernel ProgramKernel( const char *name )
+{
+	std::pair<cl_program, std::string> key( Program, name );
+	std::map<std::pair<cl_program, std::string>, ocl::Kernel>::iterator it = Kernels.find( key );
+	if( it == Kernels.end( ) )
+		it = Kernels.insert( std::make_pair( key, ocl::Kernel( Program, name ) ) ).first;
+	return it->second;
+}
+
+
+// set LocalSize, TileSize and VecWidth (and so Program) to what the named kernel should run with --
+// its settings from the tuning database if it has some, or the default ones if not (or if name is NULL)
+// k is what the kernel is about to be run with (0 if it doesn't have a k, or it changes from run to run):
+
+void UseConfig( const char *name, int k )
+{
+	KernelConfig config = DefaultConfig;
+	if( name != NULL && UseTuning )
+	{
+		std::map<std::string, KernelConfig>::iterator it = Tuned.find( name );
+		if( it != Tuned.end( ) )
+			config = it->second;
+	}
+	KeepGiven( config );
+
+	LocalSize = config.LocalSize;
+	TileSize  = config.TileSize;
+	VecWidth  = config.VecWidth;
+	MicroRows = config.MicroRows;
+	MicroCols = config.MicroCols;
+	UseProgram( k );
+}
+
+
+// can the named kernel run with the settings UseConfig( name, k ) gives it on this device? -- its work-groups have
+// to fit (see WorkGroupFits( ), which is what Tune( ) and the sweep check too), so a setting from the command line
+// that is too big for the device leaves the run out with a message, instead of every enqueue failing:
+
+bool KernelFits( const char *name, int k )
+{
+	UseConfig( name, k );
+	cl_kernel kernel = ProgramKernel( name );
+
+	size_t globalWorkSize[3], localWorkSize[3];
+	if( strncmp( name, "MatrixAdd", 9 ) == 0 )
+		AddWorkSize( name, M, N, globalWorkSize, localWorkSize );
+	else
+		GemmWorkSize( name, M, N, globalWorkSize, localWorkSize );
+	if( kernel != NULL && WorkGroupFits( kernel, Device, name, localWorkSize ) )
+		return true;
+
+	fprintf( stderr, "Leaving out %s -- it can't run with these settings on this device\n", name );
+	return false;
+}
+
+
+// put the settings that were given on the command line back into config (they are in DefaultConfig):
+
+void KeepGiven( KernelConfig &config )
+{
+	if( LocalGiven )
+		config.LocalSize = DefaultConfig.LocalSize;
+	if( TileGiven )
+		config.TileSize  = DefaultConfig.TileSize;
+	if( VecGiven )
+		config.VecWidth  = DefaultConfig.VecWidth;
+	if( MicroGiven )
+	{
+		config.MicroRows = DefaultConfig.MicroRows;
+		config.MicroCols = DefaultConfig.MicroCols;
+	}
+}
+
+
+// find the fastest settings for one kernel on the m x n x k problem (k is ignored for the MatrixAdd... kernels)
+// and keep them in Tuned:
+// the local sizes tried are the powers of 2 whose square the kernel can run as one work-group
+// (CL_KERNEL_WORK_GROUP_SIZE) and that is a whole number of CL_KERNEL_PREFERRED_WORK_GROUP_SIZE_MULTIPLE
+// -- MatrixMultTiled's local size is its tile width, so it tries tile widths instead, as long as its two tiles
+// also fit in the device's local memory -- and the ...Vec kernels try each vector width with each local size
+// each setting is run twice and the faster run counts:
+
+void Tune( const char *name, int m, int n, int k, cl_mem dA, int lda, cl_mem dB, int ldb, cl_mem dC, int ldc )
+{
+	static const int sizes[ ]  = { 2, 4, 8, 16, 32 };
+	static const int widths[ ] = { 4, 8 };
+	static const int micros[ ][2] = { { 2, 2 }, { 4, 4 }, { 4, 8 }, { 8, 4 }, { 8, 8 } };		// rows x cols
+	const int numSizes  = sizeof(sizes) / sizeof(sizes[0]);
+	const int numWidths = sizeof(widths) / sizeof(widths[0]);
+	const int numMicros = sizeof(micros) / sizeof(micros[0]);
+
+	// (the settings that were given on the command line aren't tried -- they are kept as they are)
+
+	bool add     = strncmp( name, "MatrixAdd", 9 ) == 0;
+	bool tiled   = strcmp( name, "MatrixMultTiled" ) == 0 && ! TileGiven;
+	bool blocked = strcmp( name, "MatrixMultBlocked" ) == 0 && ! MicroGiven;
+	bool vec     = strstr( name, "Vec" ) != NULL && ! VecGiven;
+	bool locals  = strcmp( name, "MatrixMultTiled" ) != 0 && ! LocalGiven;
+
+	size_t maxItems[3] = { 0, 0, 0 };
+	cl_ulong localMem = 0;
+	clGetDeviceInfo( Device, CL_DEVICE_MAX_WORK_ITEM_SIZES, sizeof(maxItems), maxItems, NULL );
+	clGetDeviceInfo( Device, CL_DEVICE_LOCAL_MEM_SIZE,      sizeof(localMem), &localMem, NULL );
+
+	bool tuning = UseTuning;
+	UseTuning = true;						// (so Gemm( ) and MatAdd( ) run each trial's settings)
+
+	KernelConfig best = DefaultConfig;
+	double bestTime = 0.;
+	for( int v = 0; v < ( vec ? numWidths : blocked ? numMicros : 1 ); v++ )
+	{
+		for( int t = 0; t < ( tiled ? numSizes : 1 ); t++ )
+		{
+			KernelConfig config = DefaultConfig;
+			if( vec )
+				config.VecWidth = widths[v];
+			if( blocked )
+			{
+				config.MicroRows = micros[v][0];
+				config.MicroCols = micros[v][1];
+			}
+			if( tiled )
+			{
+				config.TileSize = sizes[t];
+				if( 2 * (cl_ulong)sizes[t] * sizes[t] * sizeof(float) > localMem )
+					continue;
+			}
+
+			// see what the kernel built with these options can run as a work-group:
+
+			Tuned[name] = config;
+			UseConfig( name, k );
+			cl_kernel kernel = ProgramKernel( name );
+			if( kernel == NULL )
+				continue;
+			size_t groupSize = 0, multiple = 1;
+			clGetKernelWorkGroupInfo( kernel, Device, CL_KERNEL_WORK_GROUP_SIZE, sizeof(groupSize), &groupSize, NULL );
+			clGetKernelWorkGroupInfo( kernel, Device, CL_KERNEL_PREFERRED_WORK_GROUP_SIZE_MULTIPLE, sizeof(multiple), &multiple, NULL );
+			if( multiple == 0 )
+				multiple = 1;
+
+			for( int l = 0; l < ( locals ? numSizes : 1 ); l++ )
+			{
+				int local = locals ? sizes[l] : strcmp( name, "MatrixMultTiled" ) == 0 ? config.TileSize : config.LocalSize;
+				if( (size_t)( local * local ) > groupSize || (size_t)local > maxItems[0] || (size_t)local > maxItems[1] )
+					continue;
+				if( locals && ( local * local ) % multiple != 0 )
+					continue;
+
+				config.LocalSize = local;
+				Tuned[name] = config;
+
+				double time = 0.;
+				for( int trial = 0; trial < 2; trial++ )
+				{
+					Pending run = add ? MatAdd( name, m, n, dA, lda, dB, ldb, dC, ldc )
+									  : Gemm( name, m, n, k, 1.f, dA, lda, dB, ldb, 0.f, dC, ldc );
+					double seconds = run.Get( );
+					if( trial == 0 || seconds < time )
+						time = seconds;
+				}
+
+				if( time > 0. && ( bestTime == 0. || time < bestTime ) )
+				{
+					bestTime = time;
+					best = config;
+				}
+			}
+		}
+	}
+
+	Tuned[name] = best;
+	UseTuning = tuning;
+
+	if( Format == FORMAT_TEXT )
+	{
+		double flops = KernelFlops( name, m, n, k );
+		fprintf( stderr, "Tuned %-17s: local size %2d x %2d , tile %2d , vector width %d , micro-tile %d x %d : %10.2lf GFLOP/s\n",
+			name, best.LocalSize, best.LocalSize, best.TileSize, best.VecWidth, best.MicroRows, best.MicroCols,
+			bestTime > 0. ? flops / bestTime / 1000000000. : 0. );
+	}
+}
+
+
+// the tuning database is a text file with a line for each kernel that has been tuned on each device, size and
+// set of build flags:
+//		device-hash  m  n  k  fast-math  specialize  kernel  local-size  tile-size  vector-width  micro-rows  micro-cols
+// read the lines for this device, the m x n x k problem and the current FastMath and Specialize into Tuned
+// (lines from before the flags were part of the key don't say what they were tuned with, so they are ignored):
+
+void LoadTuning( int m, int n, int k )
+{
+	if( CacheDir == NULL )
+		return;
+
+	char fileName[1024];
+	snprintf( fileName, sizeof(fileName), "%s/%s", CacheDir, TUNING_FILE );
+	FILE *fp = fopen( fileName, "r" );
+	if( fp == NULL )
+		return;
+
+	unsigned long long device = DeviceHash( Device );
+	char line[512];
+	while( fgets( line, sizeof(line), fp ) != NULL )
+	{
+		unsigned long long hash;
+		int lm, ln, lk, fast, special;
+		char kernel[128];
+		KernelConfig config;
+		if( sscanf( line, "%llx %d %d %d %d %d %127s %d %d %d %d %d", &hash, &lm, &ln, &lk, &fast, &special, kernel,
+				&config.LocalSize, &config.TileSize, &config.VecWidth, &config.MicroRows, &config.MicroCols ) != 12 )
+			continue;
+		if( hash == device && lm == m && ln == n && lk == k && fast == FastMath && special == Specialize )
+			Tuned[kernel] = config;
+	}
+	fclose( fp );
+
+	if( Format == FORMAT_TEXT && ! Tuned.empty( ) )
+		fprintf( stderr, "Using the tuned settings for %d kernels from '%s'\n", (int)Tuned.size( ), fileName );
+}
+
+
+// write Tuned into the tuning database, in place of any lines for the same device, size, build flags and kernel
+// (like the cached program binaries, it is written to a temporary file and renamed):
+
+void SaveTuning( int m, int n, int k )
+{
+	if( CacheDir == NULL )
+		return;
+
+	char fileName[1024];
+	snprintf( fileName, sizeof(fileName), "%s/%s", CacheDir, TUNING_FILE );
+	char tempName[1100];
+	snprintf( tempName, sizeof(tempName), "%s.%d", fileName, (int)getpid( ) );
+
+	FILE *out = fopen( tempName, "w" );
+	if( out == NULL )
+	{
+		fprintf( stderr, "Cannot write the tuning database '%s'\n", tempName );
+		return;
+	}
+
+	// keep the lines for everything else:
+
+	unsigned long long device = DeviceHash( Device );
+	FILE *fp = fopen( fileName, "r" );
+	if( fp != NULL )
+	{
+		char line[512];
+		while( fgets( line, sizeof(line), fp ) != NULL )
+		{
+			unsigned long long hash;
+			int lm, ln, lk, fast, special;
+			char kernel[128];
+			if( sscanf( line, "%llx %d %d %d %d %d %127s", &hash, &lm, &ln, &lk, &fast, &special, kernel ) == 7
+					&& hash == device && lm == m && ln == n && lk == k && fast == FastMath && special == Specialize
+					&& Tuned.count( kernel ) > 0 )
+				continue;
+			fputs( line, out );
+		}
+		fclose( fp );
+	}
+
+	for( std::map<std::string, KernelConfig>::iterator it = Tuned.begin( ); it != Tuned.end( ); ++it )
+	{
+		fprintf( out, "%016llx %d %d %d %d %d %s %d %d %d %d %d\n", device, m, n, k, FastMath, Specialize, it->first.c_str( ),
+			it->second.LocalSize, it->second.TileSize, it->second.VecWidth, it->second.MicroRows, it->second.MicroCols );
+	}
+
+	bool ok = ( fclose( out ) == 0 );
+	if( ! ok || rename( tempName, fileName ) != 0 )
+	{
+		fprintf( stderr, "Cannot write the tuning database '%s'\n", fileName );
+		remove( tempName );
+	}
+}
+
+
+// create the kernel program from its sources and build it for device with the given options
+// the binary is cached in CacheDir under a hash of everything that goes into it (the sources,
+// the options, the device name and the driver version), and later builds of the same thing load
+// that binary instead -- if the cached binary is missing or the driver won't take it, we just
+// build from the sources again
+// returns NULL (after printing the build log) if the sources don't build:
+
+cl_program BuildProgram( cl_context context, cl_device_id device, const char **sources, int count, const char *options )
+{
+	cl_int status;
+
+	unsigned long long hash = Hash( DeviceHash( device ), options );
+	for( int i = 0; i < count; i++ )
+		hash = Hash( hash, sources[i] );
+
+	char cacheFile[1024];
+	if( CacheDir != NULL )
+	{
+		snprintf( cacheFile, sizeof(cacheFile), "%s/md_kernels_%016llx.bin", CacheDir, hash );
+
+		cl_program program = LoadProgramBinary( context, device, cacheFile, options );
+		if( program != NULL )
+		{
+			if( Format == FORMAT_TEXT )
+				fprintf( stderr, "Loaded the kernel program from '%s'\n", cacheFile );
+			return program;
+		}
+	}
+
+	cl_program program = clCreateProgramWithSource( context, count, sources, NULL, &status );
+	if( status != CL_SUCCESS )
+	{
+		fprintf( stderr, "clCreateProgramWithSource failed\n" );
+		return NULL;
+	}
+
+	status = clBuildProgram( program, 1, &device, options, NULL, NULL );
+	if( status != CL_SUCCESS )
+	{
+		size_t size;
+		clGetProgramBuildInfo( program, device, CL_PROGRAM_BUILD_LOG, 0, NULL, &size );
+		cl_char *log = new cl_char[ size ];
+		clGetProgramBuildInfo( program, device, CL_PROGRAM_BUILD_LOG, size, log, NULL );
+		fprintf( stderr, "clBuildProgram failed:\n%s\n", log );
+		delete [ ] log;
+		clReleaseProgram( program );
+		return NULL;
+	}
+
+	if( CacheDir != NULL )
+		SaveProgramBinary( program, cacheFile );
+
+	return program;
+}
+
+
+// create and build a program from a binary saved by SaveProgramBinary( )
+// returns NULL if there is no such file or the driver rejects what is in it:
+
+cl_program LoadProgramBinary( cl_context context, cl_device_id device, const char *fileName, const char *options )
+{
+	FILE *fp = fopen( fileName, "rb" );
+	if( fp == NULL )
+		return NULL;
+
+	fseek( fp, 0, SEEK_END );
+	size_t size = ftell( fp );
+	fseek( fp, 0, SEEK_SET );
+	unsigned char *binary = new unsigned char[ size ];
+	size_t n = fread( binary, 1, size, fp );
+	fclose( fp );
+
+	cl_program program = NULL;
+	if( n == size && size > 0 )
+	{
+		cl_int binaryStatus, status;
+		program = clCreateProgramWithBinary( context, 1, &device, &size, (const unsigned char **)&binary, &binaryStatus, &status );
+		if( status != CL_SUCCESS || binaryStatus != CL_SUCCESS )
+		{
+			if( program != NULL )
+				clReleaseProgram( program );
+			program = NULL;
+		}
+		else if( clBuildProgram( program, 1, &device, options, NULL, NULL ) != CL_SUCCESS )
+		{
+			clReleaseProgram( program );
+			program = NULL;
+		}
+	}
+	delete [ ] binary;
+
+	if( program == NULL )
+		fprintf( stderr, "Ignoring the cached kernel program in '%s' -- building from source\n", fileName );
+	return program;
+}
 
-// the matrix-width and the number of work-items per work-group:
-// note: the matrices are actually MATWxMATW and the work group sizes are LOCALSIZExLOCALSIZE:
 
-#ifndef MATW
-#define MATW		1024
-#endif
+// save the device binary of a built program so LoadProgramBinary( ) can pick it up next time
+// (it is written to a temporary file and renamed, so a run that starts in the middle of this
+// never sees half a file):
 
-#ifndef LOCALSIZE
-#define	LOCALSIZE	8
-#endif
+void SaveProgramBinary( cl_program program, const char *fileName )
+{
+	size_t size = 0;
+	cl_int status = clGetProgramInfo( program, CL_PROGRAM_BINARY_SIZES, sizeof(size), &size, NULL );
+	if( status != CL_SUCCESS || size == 0 )
+		return;
+
+	unsigned char *binary = new unsigned char[ size ];
+	status = clGetProgramInfo( program, CL_PROGRAM_BINARIES, sizeof(binary), &binary, NULL );
+
+	char tempName[1100];
+	snprintf( tempName, sizeof(tempName), "%s.%d", fileName, (int)getpid( ) );
+	FILE *fp = ( status == CL_SUCCESS ) ? fopen( tempName, "wb" ) : NULL;
+	if( fp != NULL )
+	{
+		size_t n = fwrite( binary, 1, size, fp );
+		fclose( fp );
+		if( n != size || rename( tempName, fileName ) != 0 )
+			remove( tempName );
+	}
+	delete [ ] binary;
+}
 
-// OpenCL objects:
-cl_platform_id		Platform;
-cl_device_id		Device;
-cl_kernel			Kernel;
-cl_program			Program;
-cl_context			Context;
-cl_command_queue	CmdQueue;
 
+// a hash of what a device is (its name and driver version), for the files that are kept for each device:
 
-// Do we want to print in csv file format?
+unsigned long long DeviceHash( cl_device_id device )
+{
+	char deviceName[256] = "";
+	char driverVersion[256] = "";
+	clGetDeviceInfo( device, CL_DEVICE_NAME,   sizeof(deviceName),    deviceName,    NULL );
+	clGetDeviceInfo( device, CL_DRIVER_VERSION, sizeof(driverVersion), driverVersion, NULL );
 
-//#define CSV
+	return Hash( Hash( 14695981039346656037ULL, deviceName ), driverVersion );
+}
 
 
-float			hA[MATW][MATW];
-float			hB[MATW][MATW];
-float			hC[MATW][MATW];
+// fold a string into a 64-bit FNV-1a hash:
 
-const char *	CL_FILE_NAME_1 = { "matrix_mult.cl" };
-const char *	CL_FILE_NAME_2 = { "matrix_add.cl" };
+unsigned long long Hash( unsigned long long hash, const char *s )
+{
+	for( ; *s != '\0'; s++ )
+	{
+		hash ^= (unsigned char)*s;
+		hash *= 1099511628211ULL;
+	}
+	hash ^= 0xff;		// mark the end of the string so "ab"+"c" and "a"+"bc" hash differently
+	hash *= 1099511628211ULL;
+	return hash;
+}
 
-// function prototypes:
-void			SelectOpenclDevice();
-char *			Vendor( cl_uint );
-char *			Type( cl_device_type );
-void			Wait( cl_command_queue );
 
+// allocate the host matrices with their rows on alignment boundaries and fill the inputs (and C0, when
+// verifying) with random numbers from Seed, so the same seed always gives the same matrices:
+// (hA and hB are also the M x N operands of MatrixAdd, so they are made big enough for that too)
 
-int main( int argc, char *argv[ ] )
+bool AllocateMatrices( size_t alignment )
 {
-#ifndef _OPENMP
-        fprintf( stderr, "OpenMP is not enabled!\n" );
-        return 1;
-#endif
+	Settle( );		// (the old matrices may still be behind a zero-copy dC that is being unmapped)
 
-	// see if we can even open the OpenCL kernel programs
-	// (no point going on if we can't):
+	if( ! hA.Allocate( M, N > K ? N : K, alignment ) || ! hB.Allocate( M > K ? M : K, N, alignment ) || ! hC.Allocate( M, N, alignment ) )
+		return false;
 
-	FILE *fp1;
-	FILE *fp2;
-#ifdef WIN32
-	errno_t err1 = fopen_s( &fp1, CL_FILE_NAME_1, "r" );
-	errno_t err2 = fopen_s( &fp2, CL_FILE_NAME_2, "r" );
-	if ( err1 != 0 || err2 != 0)
-#else
-	fp1 = fopen( CL_FILE_NAME_1, "r" );
-	fp2 = fopen( CL_FILE_NAME_2, "r" );
-	if ( fp1 == NULL || fp2 == NULL)
-#endif
+	unsigned int state = Seed;
+	for( int i = 0; i < hA.Rows; i++ )
 	{
-		fprintf( stderr, "Cannot open OpenCL source file '%s' or '%s'\n", CL_FILE_NAME_1, CL_FILE_NAME_2 );
-		return 1;
+		for( int j = 0; j < hA.Cols; j++ )
+			hA[i][j] = RandomValue( state );
 	}
 
-	cl_int status;		// returned status from opencl calls -- test against CL_SUCCESS
+	for( int i = 0; i < hB.Rows; i++ )
+	{
+		for( int j = 0; j < hB.Cols; j++ )
+			hB[i][j] = RandomValue( state );
+	}
 
+	if( Verify )
+	{
+		if( ! hC0.Allocate( M, N, alignment ) )
+			return false;
+		for( int i = 0; i < hC0.Rows; i++ )
+		{
+			for( int j = 0; j < hC0.Cols; j++ )
+				hC0[i][j] = RandomValue( state );
+		}
+	}
+	return true;
+}
 
-	// Get the platform id and the device id:
 
-	SelectOpenclDevice();		// sets the global variables Platform and Device
+// the next number in [-1.,1.) from a xorshift generator -- the same on every platform, unlike rand( ):
 
+float RandomValue( unsigned int &state )
+{
+	if( state == 0 )			// (xorshift never leaves 0)
+		state = 1;
+	state ^= state << 13;
+	state ^= state >> 17;
+	state ^= state << 5;
+	return (float)( state >> 8 ) / (float)( 1 << 23 ) - 1.f;
+}
 
-	// 2. Allocate the host memory buffers:
-	// already done -- we did it as global variables instead of on the heap so could allocate them as a 2D array
 
-	// Initialize the input matrices:
+// work out the reference results at the sampled rows and columns, in double precision:
 
-	for( int i = 0; i < MATW; i++ )
+void ComputeReference( )
+{
+	if( ! Verify )
+		return;
+
+	int numRows = ( M < VERIFY_ROWS ) ? M : VERIFY_ROWS;
+	int numCols = ( N < VERIFY_COLS ) ? N : VERIFY_COLS;
+	Ref.Rows.resize( numRows );
+	Ref.Cols.resize( numCols );
+	for( int r = 0; r < numRows; r++ )
+		Ref.Rows[r] = ( numRows == M ) ? r : (int)( (long long)r * ( M - 1 ) / ( numRows - 1 ) );
+	for( int c = 0; c < numCols; c++ )
+		Ref.Cols[c] = ( numCols == N ) ? c : (int)( (long long)c * ( N - 1 ) / ( numCols - 1 ) );
+
+	size_t count = (size_t)numRows * numCols;
+	Ref.Mult.resize( count );
+	Ref.MultBound.resize( count );
+	Ref.Add.resize( count );
+	Ref.AddBound.resize( count );
+	Ref.Scaled.resize( count );
+	Ref.ScaledBound.resize( count );
+
+	#pragma omp parallel for schedule(dynamic)
+	for( int r = 0; r < numRows; r++ )
 	{
-		for( int j = 0; j < MATW; j++ )
+		int i = Ref.Rows[r];
+		for( int c = 0; c < numCols; c++ )
 		{
-			hA[i][j] = 1.0;
-			hB[i][j] = 2.0;
+			int j = Ref.Cols[c];
+			double sum = 0., magnitude = 0.;
+			for( int kk = 0; kk < K; kk++ )
+			{
+				double product = (double)hA[i][kk] * (double)hB[kk][j];
+				sum += product;
+				magnitude += fabs( product );
+			}
+
+			size_t e = (size_t)r * numCols + c;
+			Ref.Mult[e] = sum;
+			Ref.MultBound[e] = VERIFY_TOLERANCE * (double)K * FLT_EPSILON * magnitude;
+			Ref.Add[e] = (double)hA[i][j] + (double)hB[i][j];
+			Ref.AddBound[e] = VERIFY_TOLERANCE * FLT_EPSILON * ( fabs( (double)hA[i][j] ) + fabs( (double)hB[i][j] ) );
+
+			// (scaling by alpha and adding beta * c0 are two more roundings on top of the dot product's)
+
+			double c0 = (double)GEMM_BETA * (double)hC0[i][j];
+			Ref.Scaled[e] = (double)GEMM_ALPHA * sum + c0;
+			Ref.ScaledBound[e] = VERIFY_TOLERANCE * (double)( K + 2 ) * FLT_EPSILON * ( fabs( (double)GEMM_ALPHA ) * magnitude + fabs( c0 ) );
 		}
 	}
+}
 
-	// 3. Create an OpenCL context:
 
-	Context = clCreateContext( NULL, 1, &Device, NULL, NULL, &status );
-	if( status != CL_SUCCESS )
-		fprintf( stderr, "clCreateContext failed\n" );
+// fill the result with NaNs before a run, so a kernel that misses part of it can't pass verification with
+// whatever an earlier run left there -- dC on the device, or hC if dC is NULL (for the jobs that write hC themselves):
 
+void ClearResults( cl_mem dC )
+{
+	// (the jobs that write hC themselves come through here first, so even when there's nothing to fill,
+	// a zero-copy dC that may still be being unmapped from hC has to be done with it)
 
-	// 4. Create an OpenCL command queue:
+	if( dC == NULL )
+		Settle( );
+	if( ! Verify )
+		return;
 
-	CmdQueue = clCreateCommandQueue( Context, Device, 0, &status );
-	if( status != CL_SUCCESS )
-		fprintf( stderr, "clCreateCommandQueue failed\n" );
+	float nan = NAN;
+	if( dC == NULL )
+	{
+		for( int i = 0; i < hC.Rows; i++ )
+		{
+			for( int j = 0; j < hC.Cols; j++ )
+				hC[i][j] = nan;
+		}
+		return;
+	}
 
+	// (the kernel after it on CmdQueue follows it anyway, so the host doesn't wait for it -- the pattern is
+	// copied when the fill is enqueued, and the fill is recorded with the next Settle( ))
 
-	// 5. Allocate the GPU device memory buffers for the A, B and C matrices:
+	cl_event fill = NULL;
+	cl_int status = clEnqueueFillBuffer( CmdQueue, dC, &nan, sizeof(nan), 0, hC.Bytes, 0, NULL, &fill );
+	if( status != CL_SUCCESS )
+		fprintf( stderr, "clEnqueueFillBuffer failed for dC (%d)\n", status );
 
-	size_t aSize = MATW * MATW * sizeof(float);
-	size_t bSize = MATW * MATW * sizeof(float);
-	int mw = MATW;
-	size_t mwSize = sizeof(mw);
-	size_t cSize = MATW * MATW * sizeof(float);
+	Unsettled.push_back( Pending( fill, STAGE_H2D, "Fill dC" ) );
+}
 
-	// Allocating device memory for the A matrix
-	cl_mem dA = clCreateBuffer( Context, CL_MEM_READ_ONLY, aSize, NULL, &status );
-	if( status != CL_SUCCESS )
-		fprintf( stderr, "clCreateBuffer failed for dA (1)\n" );
 
-	// Allocating device memory for the B matrix
-	cl_mem dB = clCreateBuffer( Context, CL_MEM_READ_ONLY, bSize, NULL, &status );
-	if( status != CL_SUCCESS )
-		fprintf( stderr, "clCreateBuffer failed for dB (1)\n" );
-	
-	// Allocating device memory for the width of the matrices
-	cl_mem dMW = clCreateBuffer( Context, CL_MEM_READ_ONLY, mwSize, NULL, &status );
-	if( status != CL_SUCCESS )
-		fprintf( stderr, "clCreateBuffer failed for dMW (1)\n" );
-	
-	// Allocating device memory for the C matrix
-	cl_mem dC = clCreateBuffer( Context, CL_MEM_WRITE_ONLY, cSize, NULL, &status );
-	if( status != CL_SUCCESS )
-		fprintf( stderr, "clCreateBuffer failed for dC (1)\n" );
+// start the result out as C0 for a general product -- dC on the device, or hC if dC is NULL
+// (like the fill, the upload is followed by the kernel after it on CmdQueue, and recorded with the next Settle( )):
 
-	// 6. Enqueue the 3 commands to write the data from the host buffers to the device buffers:
+void LoadC0( cl_mem dC )
+{
+	if( dC == NULL )
+	{
+		Settle( );		// (a zero-copy dC may still be being unmapped from hC)
+		memcpy( hC.Data, hC0.Data, hC.Bytes );
+		return;
+	}
 
-	// Enqueue the data from matrix A to the device.
-	status = clEnqueueWriteBuffer( CmdQueue, dA, CL_FALSE, 0, aSize, hA, 0, NULL, NULL );
+	cl_event write = NULL;
+	cl_int status = clEnqueueWriteBuffer( CmdQueue, dC, CL_FALSE, 0, hC.Bytes, hC0.Data, 0, NULL, &write );
 	if( status != CL_SUCCESS )
-		fprintf( stderr, "clEnqueueWriteBuffer failed for martix A (1)\n" );
+		fprintf( stderr, "clEnqueueWriteBuffer failed for C0 (%d)\n", status );
 
-	// Enqueue the data from matrix B to the device.
-	status = clEnqueueWriteBuffer( CmdQueue, dB, CL_FALSE, 0, bSize, hB, 0, NULL, NULL );
-	if( status != CL_SUCCESS )
-		fprintf( stderr, "clEnqueueWriteBuffer failed for matrix B (1)\n" );
-	
-	// Enqueue the matrix width data dMW the device.
-	status = clEnqueueWriteBuffer( CmdQueue, dMW, CL_FALSE, 0, mwSize, &mw, 0, NULL, NULL );
-	if( status != CL_SUCCESS )
-		fprintf( stderr, "clEnqueueWriteBuffer failed for matrix width mw (1)\n" );	
+	Unsettled.push_back( Pending( write, STAGE_H2D, "Write dC" ) );
+}
 
-	Wait( CmdQueue );
 
+// run one of the general products once with C starting out as C0 -- run( ) does it, on dC if that isn't NULL
+// (and it is read back here), or on hC -- and verify it against GEMM_ALPHA * a * b + GEMM_BETA * c0
+// (beta isn't 0, so each run changes C, and this can't be benchmarked -- it just makes sure alpha and beta,
+// and the reads of C they need, work; its commands are left out of the timing report):
 
-	// This code is for the MatrixMult and MatrixAdd GPU parallelization functions.
-	// 7. Read the kernel code from the matrix_mult.cl and matrix_add.cl files ...
-
-	// Read matrix_mult.cl for MatrixMult
-	fseek( fp1, 0, SEEK_END );
-	size_t fileSize = ftell( fp1 );
-	fseek( fp1, 0, SEEK_SET );
-	char *clProgramTextMatMult = new char[ fileSize+1 ];		// leave room for '\0'
-	size_t n = fread( clProgramTextMatMult, 1, fileSize, fp1 );
-	clProgramTextMatMult[fileSize] = '\0';
-	fclose( fp1 );
-	if( n != fileSize )
-		fprintf( stderr, "Expected to read %d bytes from '%s' -- actually read %d.\n", fileSize, CL_FILE_NAME_1, n );
-
-	// Read matrix_add.cl for MatrixAdd
-	fseek( fp2, 0, SEEK_END );
-	fileSize = ftell( fp2 );
-	fseek( fp2, 0, SEEK_SET );
-	char *clProgramTextMatAdd = new char[ fileSize+1 ];		// leave room for '\0'
-	n = fread( clProgramTextMatAdd, 1, fileSize, fp2 );
-	clProgramTextMatAdd[fileSize] = '\0';
-	fclose( fp2 );
-	if( n != fileSize )
-		fprintf( stderr, "Expected to read %d bytes from '%s' -- actually read %d.\n", fileSize, CL_FILE_NAME_2, n );
+template <typename Run>
+void CheckGemm( const char *name, cl_mem dC, Run run )
+{
+	if( ! Verify )
+		return;
+
+	size_t timings = Timings.size( );
+	bool quiet = Quiet;
+	Quiet = true;
+	LoadC0( dC );
+	run( );
+	if( dC != NULL )
+		ReadResults( dC );
+	Quiet = quiet;
+
+	std::string label = std::string( name ) + " (alpha, beta)";
+	VerifyResults( label.c_str( ), false, true );
+	if( dC != NULL )
+		ReleaseResults( dC );
+	Settle( );
+	Timings.resize( timings );
+}
 
-	// ... and create the kernel program:
 
-	char *strings[2];
-	strings[0] = clProgramTextMatMult;	// Add both the MatrixMult and MatrixAdd kernels to the list of string pointers
-	strings[1] = clProgramTextMatAdd;	// for use with creating the program.
-	Program = clCreateProgramWithSource( Context, 2, (const char **)strings, NULL, &status );	// IMPORTANT: Multiple kernel .cl files can be read in.
-	if( status != CL_SUCCESS )
-		fprintf( stderr, "clCreateProgramWithSource failed\n" );
-	delete [ ] clProgramTextMatMult;
-	delete [ ] clProgramTextMatAdd;
+// compare hC with the reference (a * b, or a + b if add is set, or GEMM_ALPHA * a * b + GEMM_BETA * c0 if
+// scaled is), report the largest absolute, relative and ULP errors, and count a failure if any element is out of bounds
+// returns false if there was a failure:
 
+bool VerifyResults( const char *name, bool add, bool scaled )
+{
+	if( ! Verify )
+		return true;
 
-	// 8. Compile and link the kernel code:
+	const std::vector<double> &ref   = scaled ? Ref.Scaled      : add ? Ref.Add      : Ref.Mult;
+	const std::vector<double> &bound = scaled ? Ref.ScaledBound : add ? Ref.AddBound : Ref.MultBound;
+	int numCols = (int)Ref.Cols.size( );
 
-	char *options = { (char *)"" };
-	status = clBuildProgram( Program, 1, &Device, options, NULL, NULL );
-	if( status != CL_SUCCESS )
+	double maxAbs = 0., maxRel = 0.;
+	long long maxUlps = 0;
+	int bad = 0;
+	for( int r = 0; r < (int)Ref.Rows.size( ); r++ )
 	{
-		size_t size;
-		clGetProgramBuildInfo( Program, Device, CL_PROGRAM_BUILD_LOG, 0, NULL, &size );
-		cl_char *log = new cl_char[ size ];
-		clGetProgramBuildInfo( Program, Device, CL_PROGRAM_BUILD_LOG, size, log, NULL );
-		fprintf( stderr, "clBuildProgram failed:\n%s\n", log );
-		delete [ ] log;
+		for( int c = 0; c < numCols; c++ )
+		{
+			size_t e = (size_t)r * numCols + c;
+			float value = hC[ Ref.Rows[r] ][ Ref.Cols[c] ];
+			double error = fabs( (double)value - ref[e] );
+			if( ! ( error <= bound[e] ) )				// (NaNs fail too)
+			{
+				if( bad == 0 )
+					fprintf( stderr, "%s: dC[%d][%d] = %.8g , expected %.8g\n", name, Ref.Rows[r], Ref.Cols[c], value, ref[e] );
+				bad++;
+			}
+			if( error != error )
+				error = HUGE_VAL;
+
+			double relative = error / ( fabs( ref[e] ) > DBL_MIN ? fabs( ref[e] ) : DBL_MIN );
+			long long ulps = UlpDistance( value, (float)ref[e] );
+			if( error > maxAbs )	maxAbs = error;
+			if( relative > maxRel )	maxRel = relative;
+			if( ulps > maxUlps )	maxUlps = ulps;
+		}
 	}
 
+	if( bad > 0 )
+		VerifyFailures++;
 
-	// 9. Create the kernel object (for MatrixMult):
-
-	// Create a Kernel for the MatrixMult function.
-	Kernel = clCreateKernel( Program, "MatrixMult", &status );
-	if( status != CL_SUCCESS )
-		fprintf( stderr, "clCreateKernel failed for MatrixMult\n" );
-
+	if( Format == FORMAT_TEXT && ! Quiet )
+		fprintf( stderr, "Verify %s: %d x %d elements checked , max abs err = %.3g , max rel err = %.3g , max ULPs = %lld -- %s\n\n",
+			name, (int)Ref.Rows.size( ), numCols, maxAbs, maxRel, maxUlps, bad > 0 ? "FAILED" : "OK" );
+	else if( bad > 0 )
+		fprintf( stderr, "Verify %s: %d elements out of tolerance -- FAILED\n", name, bad );		// (so a script's log still shows it)
+	return bad == 0;
+}
 
-	// 10. setup the arguments to the kernel object:
-	
-	// Passing the dA matrix argument to the kernal object
-	status = clSetKernelArg( Kernel, 0, sizeof(cl_mem), &dA);
-	if ( status != CL_SUCCESS )
-		fprintf( stderr, "clSetKernelArg failed for dA (%d)\n", status);
-	
-	// Passing the dB matrix argument to the kernal object
-	status = clSetKernelArg( Kernel, 1, sizeof(cl_mem), &dB);
-	if ( status != CL_SUCCESS )
-		fprintf( stderr, "clSetKernelArg failed for dB (%d)\n", status);
 
-	// Passing the dMW matrix width argument to the kernal object
-	status = clSetKernelArg( Kernel, 2, sizeof(cl_mem), &dMW);
-	if ( status != CL_SUCCESS )
-		fprintf( stderr, "clSetKernelArg failed for dMW (%d)\n", status);
+// how many representable floats apart a and b are (NaNs are as far apart as it gets):
 
-	// Passing the dC matrix argument to the kernal object
-	status = clSetKernelArg( Kernel, 3, sizeof(cl_mem), &dC);
-	if ( status != CL_SUCCESS )
-		fprintf( stderr, "clSetKernelArg failed for dC (%d)\n", status);
-	
+long long UlpDistance( float a, float b )
+{
+	if( a != a || b != b )
+		return LLONG_MAX;
+
+	int ia, ib;
+	memcpy( &ia, &a, sizeof(ia) );
+	memcpy( &ib, &b, sizeof(ib) );
+	long long la = ( ia < 0 ) ? (long long)INT_MIN - ia : ia;		// so the ordering runs straight through 0
+	long long lb = ( ib < 0 ) ? (long long)INT_MIN - ib : ib;
+	return ( la > lb ) ? la - lb : lb - la;
+}
 
-	// 11. enqueue the kernel object for execution:
 
-	size_t globalWorkSize[3] = { MATW,      MATW,      1 };
-	size_t localWorkSize[3]  = { LOCALSIZE, LOCALSIZE, 1 };
+// run MatrixMult and MatrixAdd on the host's cores with the OpenMP code in cpu_backend.h
+// (the times are wall-clock times, and there are no work-groups, so the work elements are reported as 1 x 1):
 
-#ifndef CSV
-	fprintf( stderr, "MatrixMult\n");
-	fprintf( stderr, "Number of Work Groups = %5d x %5d\n", MATW/LOCALSIZE, MATW/LOCALSIZE );
-#endif
+void RunCpuBackend( )
+{
+	Settle( );		// (a zero-copy dC may still be being unmapped from hC)
 
-	Wait( CmdQueue );
+	if( Format == FORMAT_TEXT )
+		fprintf( stderr, "Running the CPU backend on %d threads\n", omp_get_max_threads( ) );
 
-	double time0 = omp_get_wtime( );
+	ClearResults( NULL );
+	BenchStats stats = Benchmark( [&]( )
+	{
+		double time0 = omp_get_wtime( );
+		cpu::Gemm( M, N, K, 1.f, hA.Data, hA.Ld, hB.Data, hB.Ld, 0.f, hC.Data, hC.Ld );
+		return omp_get_wtime( ) - time0;
+	} );
+	PrintResults( "CPU MatrixMult", "CPU Matrix Multiplication", 1, M, N, K, stats, false );		// should match MatrixMult
+	VerifyResults( "CPU MatrixMult", false );
+	CheckGemm( "CPU MatrixMult", NULL, [&]( ) { cpu::Gemm( M, N, K, GEMM_ALPHA, hA.Data, hA.Ld, hB.Data, hB.Ld, GEMM_BETA, hC.Data, hC.Ld ); } );
+
+	ClearResults( NULL );
+	stats = Benchmark( [&]( )
+	{
+		double time0 = omp_get_wtime( );
+		cpu::Add( M, N, hA.Data, hA.Ld, hB.Data, hB.Ld, hC.Data, hC.Ld );
+		return omp_get_wtime( ) - time0;
+	} );
+	PrintResults( "CPU MatrixAdd", "CPU Matrix Addition", 1, M, N, 0, stats, false );			// should match MatrixAdd
+	VerifyResults( "CPU MatrixAdd", true );
+}
 
-	status = clEnqueueNDRangeKernel( CmdQueue, Kernel, 2, NULL, globalWorkSize, localWorkSize, 0, NULL, NULL);
-	if( status != CL_SUCCESS )
-		fprintf( stderr, "clEnqueueNDRangeKernel failed: %d\n", status );
+// sweep mode: run every kernel in SweepKernels with every work-group shape in SweepLocals and every kind of
+// math in SweepMath on the square problems in SweepSizes, and write one CSV row per point to fileName
+// (points whose work-group the device can't run -- or, for MatrixMultTiled, that aren't square or whose
+// tiles don't fit in local memory -- are left out, and so are sizes that don't fit on the device)
+// each point is benchmarked and verified like the usual runs
+// returns false if the results couldn't be written:
 
-	Wait( CmdQueue );
-	double time1 = omp_get_wtime( );
+bool RunSweep( const char *fileName )
+{
+	FILE *fp = ( strcmp( fileName, "-" ) == 0 ) ? stdout : fopen( fileName, "w" );
+	if( fp == NULL )
+	{
+		fprintf( stderr, "Cannot write the sweep results to '%s'\n", fileName );
+		return false;
+	}
 
+	std::vector<std::string> sizes, locals, kernels, maths;
+	SplitList( SweepSizes,   sizes );
+	SplitList( SweepLocals,  locals );
+	SplitList( SweepKernels, kernels );
+	SplitList( SweepMath,    maths );
 
-	// 12. read the results buffer back from the device to the host:
+	size_t maxItems[3] = { 0, 0, 0 };
+	cl_ulong localMem = 0;
+	clGetDeviceInfo( Device, CL_DEVICE_MAX_WORK_ITEM_SIZES, sizeof(maxItems), maxItems, NULL );
+	clGetDeviceInfo( Device, CL_DEVICE_LOCAL_MEM_SIZE,      sizeof(localMem), &localMem, NULL );
 
-	status = clEnqueueReadBuffer( CmdQueue, dC, CL_FALSE, 0, cSize, hC, 0, NULL, NULL );
-	if( status != CL_SUCCESS )
-			fprintf( stderr, "clEnqueueReadBuffer failed\n" );
+	fprintf( fp, "kernel,m,n,k,local_rows,local_cols,tile,vec,math,reps,min_ms,median_ms,p95_ms,stddev_ms,gflops,gbps,flop_per_byte,roofline_pct,bound,verified\n" );
 
-	Wait( CmdQueue );
+	// every point runs with its own settings, not the tuned ones:
 
+	bool tuning = UseTuning;
+	bool quiet = Quiet;
+	int fastMath = FastMath;
+	KernelConfig defaults = DefaultConfig;
+	UseTuning = false;
+	Quiet = true;
 
-#ifdef CSV
-	fprintf( stderr, "%8d , %6d , %10.2lf, %12.2f\n",
-		MATW*MATW, LOCALSIZE*LOCALSIZE, (double)MATW*(double)MATW*(double)MATW/(time1-time0)/1000000000., hC[MATW-1][MATW-1] );
-#else
-	fprintf( stderr, "Matrix Multiplication Results");								// For MatrixMult, dC[MATW-1][MATW-1] = 2.0
-	fprintf( stderr, "Matrix Size: %6d x %6d , Work Elements: %4d x %4d , GigaMultsPerSecond: %10.2lf, dC[%6d][%6d] = %12.2f\n",
-		MATW, MATW, LOCALSIZE, LOCALSIZE, (double)MATW*(double)MATW*(double)MATW/(time1-time0)/1000000000., MATW-1, MATW-1, hC[MATW-1][MATW-1] );
-#endif
-	fprintf(stderr, "\n");
+	int points = 0, skipped = 0;
+	for( size_t s = 0; s < sizes.size( ); s++ )
+	{
+		int size = atoi( sizes[s].c_str( ) );
+		M = N = K = size;
+		if( size <= 0 || ! AllocateMatrices( ZeroCopy ? PAGE_ALIGNMENT : MATRIX_ALIGNMENT ) )
+		{
+			fprintf( stderr, "Sweep: can't run size '%s'\n", sizes[s].c_str( ) );
+			continue;
+		}
+		if( hA.Bytes > DeviceMaxAlloc || hB.Bytes > DeviceMaxAlloc || hC.Bytes > DeviceMaxAlloc
+		 || hA.Bytes + hB.Bytes + hC.Bytes > DeviceGlobalMem )
+		{
+			fprintf( stderr, "Sweep: size %d doesn't fit on the device\n", size );
+			continue;
+		}
+		ComputeReference( );
 
-	// 9. Create the kernel object (for MatrixAdd):
+		cl_mem_flags hostFlags = ZeroCopy ? CL_MEM_USE_HOST_PTR : 0;
+		ocl::PooledBuffer dA = Pool.Acquire( CL_MEM_READ_ONLY  | hostFlags, hA.Bytes, ZeroCopy ? hA.Data : NULL, "dA" );
+		ocl::PooledBuffer dB = Pool.Acquire( CL_MEM_READ_ONLY  | hostFlags, hB.Bytes, ZeroCopy ? hB.Data : NULL, "dB" );
+		ocl::PooledBuffer dC = Pool.Acquire( CL_MEM_READ_WRITE | hostFlags, hC.Bytes, ZeroCopy ? hC.Data : NULL, "dC" );
 
-	// Create a Kernel for the MatrixMult function.
-	Kernel = clCreateKernel( Program, "MatrixAdd", &status );
-	if( status != CL_SUCCESS )
-		fprintf( stderr, "clCreateKernel failed for MatrixAdd\n" );
+		// (the host doesn't wait for the uploads -- the kernels have them in their wait lists instead, as in main( ))
 
+		Pending writeA, writeB;
+		std::vector<cl_event> inputs;
+		if( ! ZeroCopy )
+		{
+			cl_event aEvent = NULL, bEvent = NULL;
+			if( clEnqueueWriteBuffer( CmdQueue, dA, CL_FALSE, 0, hA.Bytes, hA.Data, 0, NULL, &aEvent ) != CL_SUCCESS
+			 || clEnqueueWriteBuffer( CmdQueue, dB, CL_FALSE, 0, hB.Bytes, hB.Data, 0, NULL, &bEvent ) != CL_SUCCESS )
+				fprintf( stderr, "clEnqueueWriteBuffer failed for the size %d matrices\n", size );
+			writeA = Pending( aEvent, STAGE_H2D, "Write dA" );
+			writeB = Pending( bEvent, STAGE_H2D, "Write dB" );
+			if( writeA.Event( ) != NULL )
+				inputs.push_back( writeA.Event( ) );
+			if( writeB.Event( ) != NULL )
+				inputs.push_back( writeB.Event( ) );
+		}
 
-	// 10. setup the arguments to the kernel object:
-	
-	// Passing the dA matrix argument to the kernal object
-	status = clSetKernelArg( Kernel, 0, sizeof(cl_mem), &dA);
-	if ( status != CL_SUCCESS )
-		fprintf( stderr, "clSetKernelArg failed for dA (%d)\n", status);
-	
-	// Passing the dB matrix argument to the kernal object
-	status = clSetKernelArg( Kernel, 1, sizeof(cl_mem), &dB);
-	if ( status != CL_SUCCESS )
-		fprintf( stderr, "clSetKernelArg failed for dB (%d)\n", status);
+		for( size_t f = 0; f < maths.size( ); f++ )
+		{
+			if( maths[f] != "strict" && maths[f] != "fast" )
+			{
+				fprintf( stderr, "Sweep: the math must be strict or fast, not '%s'\n", maths[f].c_str( ) );
+				continue;
+			}
+			FastMath = ( maths[f] == "fast" ) ? 1 : 0;
 
-	// Passing the dMW matrix width argument to the kernal object
-	status = clSetKernelArg( Kernel, 2, sizeof(cl_mem), &dMW);
-	if ( status != CL_SUCCESS )
-		fprintf( stderr, "clSetKernelArg failed for dMW (%d)\n", status);
+			for( size_t l = 0; l < locals.size( ); l++ )
+			{
+				int rows = 0, cols = 0;
+				int got = sscanf( locals[l].c_str( ), "%dx%d", &rows, &cols );
+				if( got == 1 )
+					cols = rows;
+				if( got < 1 || rows <= 0 || cols <= 0 )
+				{
+					fprintf( stderr, "Sweep: '%s' isn't a work-group shape\n", locals[l].c_str( ) );
+					continue;
+				}
 
-	// Passing the dC matrix argument to the kernal object
-	status = clSetKernelArg( Kernel, 3, sizeof(cl_mem), &dC);
-	if ( status != CL_SUCCESS )
-		fprintf( stderr, "clSetKernelArg failed for dC (%d)\n", status);
-	
+				for( size_t v = 0; v < kernels.size( ); v++ )
+				{
+					const char *name = kernels[v].c_str( );
+					bool add   = strncmp( name, "MatrixAdd", 9 ) == 0;
+					bool tiled = strcmp( name, "MatrixMultTiled" ) == 0;
+
+					DefaultConfig = defaults;
+					DefaultConfig.LocalSize = rows;
+					LocalCols = cols;
+					if( tiled )
+					{
+						DefaultConfig.TileSize = rows;
+						if( rows != cols || 2 * (cl_ulong)rows * rows * sizeof(float) > localMem )
+						{
+							skipped++;
+							continue;
+						}
+					}
 
-	// 11. enqueue the kernel object for execution:
+					// see if the kernel built with these options can run this shape as a work-group:
 
-	size_t globalWorkSize[3] = { MATW,      MATW,      1 };
-	size_t localWorkSize[3]  = { LOCALSIZE, LOCALSIZE, 1 };
+					UseConfig( name, add ? 0 : size );
+					cl_kernel kernel = ProgramKernel( name );
+					if( kernel == NULL )
+					{
+						skipped++;
+						continue;
+					}
+					size_t groupSize = 0;
+					clGetKernelWorkGroupInfo( kernel, Device, CL_KERNEL_WORK_GROUP_SIZE, sizeof(groupSize), &groupSize, NULL );
+					if( (size_t)( rows * cols ) > groupSize || (size_t)rows > maxItems[0] || (size_t)cols > maxItems[1] )
+					{
+						skipped++;
+						continue;
+					}
 
-#ifndef CSV
-	fprintf( stderr, "MatrixAdd\n");
-	fprintf( stderr, "Number of Work Groups = %5d x %5d\n", MATW/LOCALSIZE, MATW/LOCALSIZE );
-#endif
+					ClearResults( dC );
+					BenchStats stats = Benchmark( [&]( )
+					{
+						return add ? MatAdd( name, size, size, dA, hA.Ld, dB, hB.Ld, dC, hC.Ld, inputs )
+								   : Gemm( name, size, size, size, 1.f, dA, hA.Ld, dB, hB.Ld, 0.f, dC, hC.Ld, inputs );
+					} );
+					ReadResults( dC );
+					bool ok = VerifyResults( name, add );
+					ReleaseResults( dC );
+					Timings.clear( );		// (there's no timing report in a sweep)
+
+					double flops = KernelFlops( name, size, size, size );
+					double bytes = KernelBytes( name, size, size, size );
+					double gflops = flops / stats.Median / 1000000000.;
+					double gbps   = bytes / stats.Median / 1000000000.;
+					bool memoryBound;
+					double percent = RooflinePercent( gflops, flops / bytes, &memoryBound );
+					fprintf( fp, "%s,%d,%d,%d,%d,%d,%d,%d,%s,%d,%.6lf,%.6lf,%.6lf,%.6lf,%.4lf,%.4lf,%.4lf,%.2lf,%s,%d\n",
+						name, size, size, add ? 0 : size, rows, cols, TileSize, VecWidth, maths[f].c_str( ), stats.Reps,
+						stats.Min*1000., stats.Median*1000., stats.P95*1000., stats.StdDev*1000., gflops, gbps, flops / bytes,
+						percent, percent <= 0. ? "" : memoryBound ? "memory" : "compute", ok ? 1 : 0 );
+					fflush( fp );
+					points++;
+
+					if( Format == FORMAT_TEXT )
+						fprintf( stderr, "Sweep: %-17s %5d , local %2d x %2d , %-6s : %10.2lf GFLOP/s , %8.2lf GB/s%s\n",
+							name, size, rows, cols, maths[f].c_str( ), gflops, gbps, ok ? "" : " -- FAILED" );
+				}
+			}
+		}
 
-	Wait( CmdQueue );
+		writeA.Get( );
+		writeB.Get( );
+		Settle( );		// (the last unmap has to be done before this size's buffers and matrices go away)
+	}
 
-	double time0 = omp_get_wtime( );
+	UseTuning = tuning;
+	Quiet = quiet;
+	FastMath = fastMath;
+	DefaultConfig = defaults;
+	LocalCols = 0;
 
-	status = clEnqueueNDRangeKernel( CmdQueue, Kernel, 2, NULL, globalWorkSize, localWorkSize, 0, NULL, NULL);
-	if( status != CL_SUCCESS )
-		fprintf( stderr, "clEnqueueNDRangeKernel failed: %d\n", status );
+	if( Format == FORMAT_TEXT )
+		fprintf( stderr, "Sweep: %d points written to '%s' (%d left out)\n", points, fileName, skipped );
+	if( VerifyFailures > 0 )
+		fprintf( stderr, "%d results failed verification\n", VerifyFailures );
 
-	Wait( CmdQueue );
-	double time1 = omp_get_wtime( );
+	if( fp != stdout )
+		fclose( fp );
+	return true;
+}
 
 
-	// 12. read the results buffer back from the device to the host:
+// split a comma-separated list into its items (empty items are dropped):
 
-	status = clEnqueueReadBuffer( CmdQueue, dC, CL_FALSE, 0, cSize, hC, 0, NULL, NULL );
-	if( status != CL_SUCCESS )
-			fprintf( stderr, "clEnqueueReadBuffer failed\n" );
+void SplitList( const char *list, std::vector<std::string> &items )
+{
+	items.clear( );
+	std::string item;
+	for( const char *p = list; ; p++ )
+	{
+		if( *p == ',' || *p == '\0' )
+		{
+			if( ! item.empty( ) )
+				items.push_back( item );
+			item.clear( );
+			if( *p == '\0' )
+				break;
+		}
+		else
+			item += *p;
+	}
+}
 
-	Wait( CmdQueue );
 
+// what one run of each kernel does on an m x n x k problem: the MatrixMult... kernels do a multiply-add
+// (2 operations) for each of the m x n x k terms, and the MatrixAdd... kernels do one add for each of the
+// m x n elements of c and ignore k
+// (name can have something in front of the kernel name, like "CPU MatrixAdd" -- it's still the same job):
 
-#ifdef CSV
-	fprintf( stderr, "%8d , %6d , %10.2lf, %12.2f\n",
-		MATW*MATW, LOCALSIZE*LOCALSIZE, (double)MATW*(double)MATW*(double)MATW/(time1-time0)/1000000000., hC[MATW-1][MATW-1] );
-#else
-	fprintf( stderr, "Matrix Additionn Results");									// For MatrixAdd, dC[MATW-1][MATW-1] = 3.0
-	fprintf( stderr, "Matrix Size: %6d x %6d , Work Elements: %4d x %4d , GigaAddsPerSecond: %10.2lf, dC[%6d][%6d] = %12.2f\n",
-		MATW, MATW, LOCALSIZE, LOCALSIZE, (double)MATW*(double)MATW*(double)MATW/(time1-time0)/1000000000., MATW-1, MATW-1, hC[MATW-1][MATW-1] );
-#endif
-	fprintf(stderr, "\n");
+double KernelFlops( const char *name, int m, int n, int k )
+{
+	if( strstr( name, "MatrixAdd" ) != NULL )
+		return (double)m * (double)n;
+	return 2. * (double)m * (double)n * (double)k;
+}
 
-	// 13. clean everything up:
 
-	clReleaseKernel(        Kernel   );
-	clReleaseProgram(       Program  );
-	clReleaseCommandQueue(  CmdQueue );
-	clReleaseMemObject(     dA  );
-	clReleaseMemObject(     dB  );
-	clReleaseMemObject(     dMW  );
-	clReleaseMemObject(     dC  );
+// the fewest bytes of global memory one run of the named kernel has to move: each of its matrices read
+// or written once (with beta = 0, so c is only written) -- more than that is traffic the caches missed:
 
-	return 0;
+double KernelBytes( const char *name, int m, int n, int k )
+{
+	if( strstr( name, "MatrixAdd" ) != NULL )
+		return 3. * (double)m * (double)n * sizeof(float);
+	return ( (double)m * (double)k + (double)k * (double)n + (double)m * (double)n ) * sizeof(float);
 }
 
 
-// wait until all queued tasks have taken place:
+// release the OpenCL objects the globals hold (the caller has already handed its buffers back to the pool)
+// -- this is done at the end of main( ) rather than after it returns, when the OpenCL library may already be gone:
 
-void Wait( cl_command_queue queue )
+void ReleaseAll( )
 {
-      cl_event wait;
-      cl_int      status;
+	Settle( );
+	if( Format == FORMAT_TEXT )
+		Pool.PrintStats( stderr );
+	Pool.Trim( );
+	Workers.clear( );
+	Kernels.clear( );
+	Program = NULL;
+	Programs.clear( );
+	delete [ ] ProgramSources[0];
+	delete [ ] ProgramSources[1];
+	CmdQueue.Reset( );
+	Context.Reset( );
+}
+
 
-      status = clEnqueueMarker( queue, &wait );
-      if( status != CL_SUCCESS )
-	      fprintf( stderr, "Wait: clEnqueueMarker failed\n" );
 
-      status = clWaitForEvents( 1, &wait );
-      if( status != CL_SUCCESS )
-	      fprintf( stderr, "Wait: clWaitForEvents failed\n" );
+// round n up to the next multiple of m (global work sizes must be multiples of the local work size):
+
+size_t RoundUp( size_t n, size_t m )
+{
+	return ( ( n + m - 1 ) / m ) * m;
 }
 
 
@@ -404,16 +3608,10 @@ void Wait( cl_command_queue queue )
 void SelectOpenclDevice()
 {
 		// select which opencl device to use:
-		// priority order:
-		//	1. a gpu
-		//	2. an nvidia or amd gpu
-		//	3. an intel gpu
-		//	4. an intel cpu
-
-	int bestPlatform = -1;
-	int bestDevice = -1;
-	cl_device_type bestDeviceType;
-	cl_uint bestDeviceVendor;
+		//	1. the one named on the command line (-device), if there is one
+		//	2. otherwise the one that does best in ProbeDevice( ) -- so the choice follows what
+		//	   each device can actually do rather than what kind of device it is or who made it
+
 	cl_int status;		// returned status from opencl calls
 				// test against CL_SUCCESS
 
@@ -429,6 +3627,11 @@ void SelectOpenclDevice()
 	if( status != CL_SUCCESS )
 		fprintf(stderr, "clGetPlatformIDs failed (2)\n");
 
+	// number every device on every platform in the order we find them (that is what -device INDEX counts):
+
+	std::vector<int> platformOf;
+	std::vector<int> indexOn;
+	std::vector<cl_device_id> all;
 	for( int p = 0; p < (int)numPlatforms; p++ )
 	{
 		// find out how many devices are attached to each platform and get their ids:
@@ -437,7 +3640,10 @@ void SelectOpenclDevice()
 
 		status = clGetDeviceIDs(platforms[p], CL_DEVICE_TYPE_ALL, 0, NULL, &numDevices);
 		if( status != CL_SUCCESS )
-			fprintf(stderr, "clGetDeviceIDs failed (2)\n");
+		{
+			fprintf(stderr, "clGetDeviceIDs failed (1)\n");
+			continue;
+		}
 
 		cl_device_id* devices = new cl_device_id[numDevices];
 		status = clGetDeviceIDs(platforms[p], CL_DEVICE_TYPE_ALL, numDevices, devices, NULL);
@@ -446,70 +3652,242 @@ void SelectOpenclDevice()
 
 		for( int d = 0; d < (int)numDevices; d++ )
 		{
-			cl_device_type type;
-			cl_uint vendor;
-			size_t sizes[3] = { 0, 0, 0 };
-
-			clGetDeviceInfo(devices[d], CL_DEVICE_TYPE, sizeof(type), &type, NULL);
+			platformOf.push_back( p );
+			indexOn.push_back( d );
+			all.push_back( devices[d] );
+		}
+		delete [ ] devices;
+	}
 
-			clGetDeviceInfo(devices[d], CL_DEVICE_VENDOR_ID, sizeof(vendor), &vendor, NULL);
+	if( all.empty( ) )
+	{
+		fprintf(stderr, "I found no OpenCL devices!\n");
+		exit( 1 );
+	}
 
-			// select:
+	int best = -1;
+	if( DeviceChoice != NULL )
+	{
+		// a number picks that device, anything else picks the first device with that in its name:
 
-			if( bestPlatform < 0 )		// not yet holding anything -- we'll accept anything
+		char *end;
+		long index = strtol( DeviceChoice, &end, 10 );
+		if( *DeviceChoice != '\0' && *end == '\0' )
+		{
+			if( index >= 0 && index < (long)all.size( ) )
+				best = (int)index;
+		}
+		else
+		{
+			for( int i = 0; i < (int)all.size( ) && best < 0; i++ )
 			{
-				bestPlatform = p;
-				bestDevice = d;
-				Platform = platforms[bestPlatform];
-				Device = devices[bestDevice];
-				bestDeviceType = type;
-				bestDeviceVendor = vendor;
+				char name[256] = "";
+				clGetDeviceInfo( all[i], CL_DEVICE_NAME, sizeof(name), name, NULL );
+				if( strstr( name, DeviceChoice ) != NULL )
+					best = i;
 			}
-			else					// holding something already -- can we do better?
+		}
+
+		if( best < 0 )
+		{
+			fprintf( stderr, "There is no OpenCL device '%s' -- there are %d, numbered from 0\n", DeviceChoice, (int)all.size( ) );
+			exit( 1 );
+		}
+		ProbeDevice( all[best], &DeviceGflops, &DeviceGbps );
+	}
+	else
+	{
+		double bestScore = -1.;
+		for( int i = 0; i < (int)all.size( ); i++ )
+		{
+			double gflops, gbps;
+			double score = ProbeDevice( all[i], &gflops, &gbps );
+			if( score > bestScore )
 			{
-				if( bestDeviceType == CL_DEVICE_TYPE_CPU )		// holding a cpu already -- switch to a gpu if possible
-				{
-					if( type == CL_DEVICE_TYPE_GPU )			// found a gpu
-					{										// switch to the gpu we just found
-						bestPlatform = p;
-						bestDevice = d;
-						Platform = platforms[bestPlatform];
-						Device = devices[bestDevice];
-						bestDeviceType = type;
-						bestDeviceVendor = vendor;
-					}
-				}
-				else										// holding a gpu -- is a better gpu available?
-				{
-					if( bestDeviceVendor == ID_INTEL )			// currently holding an intel gpu
-					{										// we are assuming we just found a bigger, badder nvidia or amd gpu
-						bestPlatform = p;
-						bestDevice = d;
-						Platform = platforms[bestPlatform];
-						Device = devices[bestDevice];
-						bestDeviceType = type;
-						bestDeviceVendor = vendor;
-					}
-				}
+				bestScore = score;
+				best = i;
+				DeviceGflops = gflops;
+				DeviceGbps = gbps;
 			}
 		}
-		delete [ ] devices;
 	}
+
+	Platform = platforms[ platformOf[best] ];
+	Device = all[best];
 	delete [ ] platforms;
 
+	cl_device_type type;
+	cl_uint vendor;
+	clGetDeviceInfo( Device, CL_DEVICE_TYPE, sizeof(type), &type, NULL );
+	clGetDeviceInfo( Device, CL_DEVICE_VENDOR_ID, sizeof(vendor), &vendor, NULL );
+	if( Format == FORMAT_TEXT )
+	{
+		fprintf(stderr, "I have selected Platform #%d, Device #%d: ", platformOf[best], indexOn[best]);
+		fprintf(stderr, "Vendor = %s, Type = %s\n", Vendor(vendor), Type(type) );
+		if( DeviceGflops > 0. && DeviceGbps > 0. )
+			fprintf( stderr, "Roofline: %.1lf GFLOP/s , %.1lf GB/s -- kernels under %.2lf FLOP/byte are memory-bound\n",
+				DeviceGflops, DeviceGbps, DeviceGflops / DeviceGbps );
+	}
+}
+
+
+// find out how fast a device is, from the probe kernels in probe.cl:
+//	*gflops		the floating-point operations per second ProbeFlops gets, in billions
+//	*gbps		the bytes per second ProbeBandwidth moves through global memory, in billions
+// the results are cached in CacheDir under a hash of the device name and driver version, so each
+// device on a machine is only probed once
+// if the probe can't be run, both are estimated from the compute units and clock rate instead
+// returns a score for choosing between devices -- the rate at which the device would get through
+// a job that is one part floating-point operations to one part bytes moved, so a device has to be
+// good at both to come out ahead:
 
-	if( bestPlatform < 0 )
+double ProbeDevice( cl_device_id device, double *gflops, double *gbps )
+{
+	char name[256] = "";
+	cl_uint units = 0, clock = 0;
+	cl_ulong globalMem = 0, maxAlloc = 0;
+	clGetDeviceInfo( device, CL_DEVICE_NAME,              sizeof(name),          name,          NULL );
+	clGetDeviceInfo( device, CL_DEVICE_MAX_COMPUTE_UNITS,  sizeof(units),         &units,        NULL );
+	clGetDeviceInfo( device, CL_DEVICE_MAX_CLOCK_FREQUENCY, sizeof(clock),        &clock,        NULL );
+	clGetDeviceInfo( device, CL_DEVICE_GLOBAL_MEM_SIZE,    sizeof(globalMem),     &globalMem,    NULL );
+	clGetDeviceInfo( device, CL_DEVICE_MAX_MEM_ALLOC_SIZE, sizeof(maxAlloc),      &maxAlloc,     NULL );
+
+	*gflops = *gbps = 0.;
+
+	unsigned long long hash = DeviceHash( device );
+	char cacheFile[1024];
+	FILE *fp = NULL;
+	if( CacheDir != NULL )
 	{
-		fprintf(stderr, "I found no OpenCL devices!\n");
-		exit( 1 );
+		snprintf( cacheFile, sizeof(cacheFile), "%s/md_probe_%016llx.txt", CacheDir, hash );
+		fp = fopen( cacheFile, "r" );
 	}
-	else
+	if( fp != NULL )
 	{
-#ifndef CSV
-		fprintf(stderr, "I have selected Platform #%d, Device #%d: ", bestPlatform, bestDevice);
-		fprintf(stderr, "Vendor = %s, Type = %s\n", Vendor(bestDeviceVendor), Type(bestDeviceType) );
-#endif
+		if( fscanf( fp, "%lf %lf", gflops, gbps ) != 2 )
+			*gflops = *gbps = 0.;
+		fclose( fp );
+	}
+
+	if( *gflops <= 0. || *gbps <= 0. )
+	{
+		*gflops = *gbps = 0.;
+
+		char *source = GetKernelSource( CL_FILE_NAME_PROBE );
+		ocl::Context context( device );
+		ocl::Queue queue;
+		ocl::Program program;
+		if( source != NULL && context.Ok( ) )
+		{
+			queue = ocl::Queue( context, device, CL_QUEUE_PROFILING_ENABLE );
+			char options[64];
+			snprintf( options, sizeof(options), "-DPROBEITERS=%d", PROBE_ITERS );
+			program = ocl::Program( BuildProgram( context, device, (const char **)&source, 1, options ) );
+		}
+		delete [ ] source;
+
+		if( queue.Ok( ) && program.Ok( ) )
+		{
+			// the bandwidth probe copies one buffer to another, as big as the device allows up to PROBE_BYTES:
+
+			size_t bytes = PROBE_BYTES;
+			if( bytes > maxAlloc )
+				bytes = (size_t)maxAlloc;
+			if( bytes > globalMem / 4 )
+				bytes = (size_t)( globalMem / 4 );
+			size_t count = bytes / ( 4 * sizeof(float) );
+			count -= count % 64;
+
+			ocl::Buffer<float> src( context, CL_MEM_READ_ONLY,  4 * count, NULL, "the probe source" );
+			ocl::Buffer<float> dst( context, CL_MEM_WRITE_ONLY, 4 * count, NULL, "the probe destination" );
+			cl_mem srcMem = src, dstMem = dst;
+			ocl::Kernel copy( program, "ProbeBandwidth" );
+			SetKernelArg( copy, 0, sizeof(cl_mem), &srcMem, "src" );
+			SetKernelArg( copy, 1, sizeof(cl_mem), &dstMem, "dst" );
+			double seconds = ProbeKernel( queue, copy, count );
+			if( seconds > 0. )
+				*gbps = 2. * (double)count * 4. * sizeof(float) / seconds / 1000000000.;
+
+			// the flop probe runs work-items of PROBEITERS times around 4 multiply-adds -- PROBE_ITEMS of them
+			// to start with, and twice as many each time until a run takes PROBE_SECONDS
+			// (a short run leaves a big device mostly idle, or is mostly launch overhead, and understates it)
+			// or the output buffer is as big as the bandwidth probe's:
+
+			size_t maxItems = ( 4 * count > PROBE_ITEMS ) ? 4 * count : PROBE_ITEMS;
+			float seed = 1.f;
+			ocl::Buffer<float> out( context, CL_MEM_WRITE_ONLY, maxItems, NULL, "the probe output" );
+			cl_mem outMem = out;
+			ocl::Kernel flops( program, "ProbeFlops" );
+			SetKernelArg( flops, 0, sizeof(float),  &seed,   "seed" );
+			SetKernelArg( flops, 1, sizeof(cl_mem), &outMem, "dst" );
+			for( size_t items = PROBE_ITEMS; items <= maxItems; items *= 2 )
+			{
+				seconds = ProbeKernel( queue, flops, items );
+				if( seconds <= 0. )
+					break;
+				*gflops = (double)items * PROBE_ITERS * 4. * 2. / seconds / 1000000000.;
+				if( seconds >= PROBE_SECONDS )
+					break;
+			}
+		}
+
+		// (the cache is written to a temporary file that is renamed into place, as SaveTuning( ) does,
+		// so another run never sees half of it)
+
+		if( *gflops > 0. && *gbps > 0. )
+		{
+			if( CacheDir != NULL )
+			{
+				char tempName[1100];
+				snprintf( tempName, sizeof(tempName), "%s.%d", cacheFile, (int)getpid( ) );
+				if( ( fp = fopen( tempName, "w" ) ) != NULL )
+				{
+					fprintf( fp, "%.3lf %.3lf\n", *gflops, *gbps );
+					if( fclose( fp ) != 0 || rename( tempName, cacheFile ) != 0 )
+						remove( tempName );
+				}
+			}
+		}
+		else
+		{
+			// (a guess: one multiply-add per clock per compute unit, and about a byte per clock per compute unit)
+
+			fprintf( stderr, "Could not probe '%s' -- estimating its speed from its compute units and clock rate\n", name );
+			*gflops = 2. * (double)units * (double)clock / 1000.;
+			*gbps   = (double)units * (double)clock / 1000.;
+		}
+	}
+
+	double score = ( *gflops > 0. && *gbps > 0. ) ? 1. / ( 1. / *gflops + 1. / *gbps ) : 0.;
+	if( Format == FORMAT_TEXT )
+		fprintf( stderr, "'%s': %u compute units at %u MHz, %.0lf MB -- %.1lf GFLOP/s, %.1lf GB/s, score %.1lf\n",
+			name, units, clock, (double)globalMem / 1048576., *gflops, *gbps, score );
+	return score;
+}
+
+
+// run a 1D probe kernel twice over count work-items (the first run pays for getting the device going)
+// returns the second run's device time in seconds, or 0 if it couldn't be run:
+
+double ProbeKernel( cl_command_queue queue, cl_kernel kernel, size_t count )
+{
+	double seconds = 0.;
+	for( int trial = 0; trial < 2; trial++ )
+	{
+		cl_event run = NULL;
+		cl_int status = clEnqueueNDRangeKernel( queue, kernel, 1, NULL, &count, NULL, 0, NULL, &run );
+		if( status != CL_SUCCESS )
+		{
+			fprintf( stderr, "clEnqueueNDRangeKernel failed for a probe kernel: %d\n", status );
+			return 0.;
+		}
+		clWaitForEvents( 1, &run );
+		cl_ulong start = EventTime( run, CL_PROFILING_COMMAND_START );
+		cl_ulong end   = EventTime( run, CL_PROFILING_COMMAND_END );
+		clReleaseEvent( run );
+		seconds = ( end > start ) ? (double)( end - start ) / 1000000000. : 0.;
 	}
+	return seconds;
 }
 
 char * Vendor( cl_uint v )
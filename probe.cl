@@ -0,0 +1,42 @@
+#define IN
+#define OUT
+
+// short kernels the host times to see how fast a device really is -- how many bytes per second it
+// can stream through global memory, and how many floating-point operations per second it can do
+
+
+kernel void ProbeBandwidth( IN global const float4 *src, OUT global float4 *dst )
+{
+	// each work-item reads one float4 and writes it back out somewhere else,
+	// so the kernel moves 2 * 16 bytes per work-item
+
+	int i = get_global_id( 0 );
+	dst[i] = src[i];
+}
+
+
+// how many times ProbeFlops goes around its loop:
+
+#ifndef PROBEITERS
+#define PROBEITERS	256
+#endif
+
+kernel void ProbeFlops( float seed, OUT global float *dst )
+{
+	// each work-item runs 4 independent chains of multiply-adds (so they can overlap in the pipeline),
+	// which is 4 * 2 floating-point operations per time around the loop
+	// the result is stored so the compiler can't throw the loop away
+
+	float x = seed + (float)get_global_id( 0 );
+	float a = x, b = x + 1.f, c = x + 2.f, d = x + 3.f;
+
+	for( int i = 0; i < PROBEITERS; i++ )
+	{
+		a = mad( a, 0.999f, 0.001f );
+		b = mad( b, 0.999f, 0.001f );
+		c = mad( c, 0.999f, 0.001f );
+		d = mad( d, 0.999f, 0.001f );
+	}
+
+	dst[ get_global_id( 0 ) ] = a + b + c + d;
+}
\ No newline at end of file